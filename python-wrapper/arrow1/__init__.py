@@ -20,3 +20,4 @@
 # Comments and/or additions are welcome. Send e-mail to: cbrown1@pitt.edu.
 #
 from .arrow1 import jack_running, play_rec, get_ports
+from .shm import ShmReader
@@ -1,6 +1,7 @@
 import subprocess
 import tempfile
 import os
+import re
 import time
 import numpy as _np
 #import scipy.io.wavfile as _wf
@@ -28,7 +29,7 @@ def jack_running(name="jackd"):
     return ret
 
 
-def play_rec(play=None, rec=None, input_ports=None, output_ports=None, duration_secs=None, start_offset_secs=None, fs=None):
+def play_rec(play=None, rec=None, input_ports=None, output_ports=None, duration_secs=None, start_offset_secs=None, fs=None, ram=False):
     """Frontend to arrow1 - play and record multi-channel sound using Jack
 
     Parameters
@@ -52,6 +53,11 @@ def play_rec(play=None, rec=None, input_ports=None, output_ports=None, duration_
     fs: int
         Sampling frequency. Required if play is numpy array (must match Jack 
         engine sample rate), otherwise ignored.
+    ram: bool
+        record into locked memory and write the file only after the take, so that
+        there is no disk activity while recording; requires a known duration (either
+        duration_secs or that of play). If rec is True, the take is streamed from
+        arrow1 directly into the returned array and never touches the disk.
     
     returns
     -------
@@ -69,7 +75,7 @@ def play_rec(play=None, rec=None, input_ports=None, output_ports=None, duration_
         play_cleanup = True
 
     rec_cleanup = False
-    if rec is True:
+    if rec is True and not ram:
         rec = tempfile.NamedTemporaryFile(suffix='.wav', delete=False).name
         rec_cleanup = True
 
@@ -80,13 +86,32 @@ def play_rec(play=None, rec=None, input_ports=None, output_ports=None, duration_
         args.append(f"--out={','.join(output_ports)}")
     if play:
         args.append(f"--read-file={play}")
-    if rec:
+    if rec is True:
+        # Take is streamed through stdout as raw float32 once recorded
+        args.append("--write-file=-")
+    elif rec:
         args.append(f"--write-file={rec}")
+    if ram:
+        args.append("--ram")
     if duration_secs is not None:
         args.append(f"--duration={duration_secs}")
     if start_offset_secs is not None:
         args.append(f"--start={start_offset_secs}")
 
+    if rec is True:
+        with subprocess.Popen(args, stdout=subprocess.PIPE, stderr=subprocess.PIPE) as p:
+            data, report = p.communicate()
+        report = report.decode()
+        print(report)
+        if play_cleanup:
+            os.remove(play)
+        if p.returncode != 0:
+            raise RuntimeError(report)
+        frames = int(re.search(r"frames written: (\d+)", report).group(1))
+        fs = int(re.search(r"sample rate: (\d+)", report).group(1))
+        channels = len(data) // (4 * frames) if frames else 0
+        return _np.frombuffer(data, dtype=_np.float32).reshape(frames, channels), fs
+
     with subprocess.Popen(args, stdout=subprocess.PIPE, universal_newlines=True) as p:
         std_out, _ = p.communicate()
         print(std_out)
@@ -0,0 +1,113 @@
+import mmap
+import os
+import struct
+import time
+import numpy as _np
+
+try:
+    import _posixshmem
+except ImportError:
+    _posixshmem = None
+
+# Mirrors struct arrow1_shm_header & struct arrow1_shm_block from src/arrow1_shm.h
+_HEADER = struct.Struct('=QIIIIIIQQQQ')
+_BLOCK = struct.Struct('=QQII')
+_MAGIC = 0x474e524d48533141
+_VERSION = 1
+_FINISHED = 1
+_WRITE_INDEX_OFFSET = 48
+
+
+class ShmReader:
+    """Reads audio published live by `arrow1 --shm=NAME`
+
+    Any number of readers may attach to the same stream, they don't affect arrow1
+    or each other. Frames which a reader doesn't collect within one ring length
+    are lost; read() reports how many.
+
+    Example
+    -------
+    >>> with ShmReader('mystream') as r:
+    ...     while not r.finished:
+    ...         frames, lost = r.read()
+    ...         print(frames.shape, abs(frames).max(axis=0))
+    ...         time.sleep(.1)
+    """
+
+    def __init__(self, name, timeout=5.):
+        if _posixshmem is None:
+            raise OSError("POSIX shared memory is not supported on this platform")
+        name = name if name.startswith('/') else '/' + name
+        deadline = time.monotonic() + timeout
+        while True:
+            try:
+                fd = _posixshmem.shm_open(name, os.O_RDONLY, 0)
+                break
+            except FileNotFoundError:
+                if time.monotonic() > deadline:
+                    raise
+                time.sleep(.05)
+        try:
+            self._mm = mmap.mmap(fd, 0, prot=mmap.PROT_READ)
+        finally:
+            os.close(fd)
+        (magic, version, self.channels, self.sample_rate, self.capacity, self.block_capacity,
+            _, self._blocks_offset, data_offset, _, _) = _HEADER.unpack_from(self._mm, 0)
+        if magic != _MAGIC or version != _VERSION:
+            self._mm.close()
+            raise ValueError("{} is not an arrow1 stream of version {}".format(name, _VERSION))
+        self.name = name
+        self._data = _np.frombuffer(self._mm, dtype=_np.float32,
+            count=self.capacity * self.channels, offset=data_offset).reshape(self.capacity, self.channels)
+        self.position = self.write_index
+
+    @property
+    def write_index(self):
+        """Number of frames published so far"""
+        return struct.unpack_from('=Q', self._mm, _WRITE_INDEX_OFFSET)[0]
+
+    @property
+    def finished(self):
+        """True once arrow1 stopped capturing"""
+        return _HEADER.unpack_from(self._mm, 0)[6] == _FINISHED
+
+    def read(self, max_frames=None):
+        """Returns (frames, lost) where frames is a (n, channels) array of frames
+        published since previous read and lost the number of frames overwritten
+        before they could be read.
+        """
+        w = self.write_index
+        lost = 0
+        if w - self.position > self.capacity:
+            lost = w - self.capacity - self.position
+            self.position = w - self.capacity
+        if max_frames is not None:
+            w = min(w, self.position + max_frames)
+        idx = _np.arange(self.position, w) & (self.capacity - 1)
+        frames = self._data[idx].copy()
+        # Frames overwritten while copying are unreliable, drop them
+        stale = self.write_index - self.capacity - self.position
+        if stale > 0:
+            frames = frames[stale:]
+            lost += stale
+        self.position = w
+        return frames, lost
+
+    def blocks(self):
+        """Returns list of (frame_index, usecs, jack_frame, frame_count) entries
+        of Jack cycles still held in the block table, oldest first.
+        """
+        end = _HEADER.unpack_from(self._mm, 0)[10]
+        start = max(0, end - self.block_capacity)
+        return [_BLOCK.unpack_from(self._mm, self._blocks_offset + (b & (self.block_capacity - 1)) * _BLOCK.size)
+            for b in range(start, end)]
+
+    def close(self):
+        self._data = None
+        self._mm.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
@@ -0,0 +1,73 @@
+/*
+ * Layout of the shared-memory segment arrow1 publishes captured audio into
+ * when started with --shm=NAME. Plain C so that external readers can include
+ * it directly.
+ *
+ * The segment is created with shm_open("/" NAME) and consists of:
+ *
+ *   struct arrow1_shm_header                  at offset 0
+ *   struct arrow1_shm_block[block_capacity]   at offset blocks_offset
+ *   float[capacity * channels]                at offset data_offset
+ *
+ * Samples are interleaved 32-bit floats. Frame number `f` of the stream lives
+ * at data frame index `f & (capacity - 1)`. Every Jack process cycle appends
+ * one entry to the block table, describing which stream frames were captured
+ * in that cycle and when; entry number `b` lives at `b & (block_capacity - 1)`.
+ *
+ * There is a single writer and no locks. The writer fills samples and block
+ * entries first and then publishes them by storing `write_index` and
+ * `block_index` with release semantics. A reader:
+ *
+ *   1. loads `write_index` (acquire) as `w`,
+ *   2. copies frames from range [max(r, w - capacity), w), where `r` is the
+ *      next frame it wants,
+ *   3. loads `write_index` again as `w2`; frames older than `w2 - capacity`
+ *      may have been overwritten while copying and must be discarded.
+ *
+ * `state` switches from ARROW1_SHM_RUNNING to ARROW1_SHM_FINISHED when arrow1
+ * stops capturing; the segment name is unlinked at the same time, but mapped
+ * segments stay valid until readers unmap them.
+ */
+#ifndef ARROW1_SHM_H
+#define ARROW1_SHM_H
+
+#include <stdint.h>
+
+#define ARROW1_SHM_MAGIC 0x474e524d48533141ULL /* "A1SHMRNG" in memory byte order */
+#define ARROW1_SHM_VERSION 1
+
+enum arrow1_shm_state {
+    ARROW1_SHM_RUNNING = 0,
+    ARROW1_SHM_FINISHED = 1
+};
+
+struct arrow1_shm_header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t channels;
+    uint32_t sample_rate;
+    /* Sample ring size in frames, power of 2 */
+    uint32_t capacity;
+    /* Block table size in entries, power of 2 */
+    uint32_t block_capacity;
+    uint32_t state;
+    uint64_t blocks_offset;
+    uint64_t data_offset;
+    /* Number of frames published so far */
+    uint64_t write_index;
+    /* Number of block table entries published so far */
+    uint64_t block_index;
+};
+
+struct arrow1_shm_block {
+    /* Stream frame number of the first frame captured in this cycle */
+    uint64_t frame_index;
+    /* Jack clock (jack_get_time(), usecs) at start of the cycle */
+    uint64_t usecs;
+    /* jack_last_frame_time() of the cycle */
+    uint32_t jack_frame;
+    /* Frames captured in this cycle */
+    uint32_t frame_count;
+};
+
+#endif
@@ -0,0 +1,321 @@
+#include "cache.hpp"
+#include "log.hpp"
+
+#include <boost/format.hpp>
+
+#include <stdexcept>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+
+#ifndef _WIN32
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <sys/time.h>
+# include <fcntl.h>
+# include <unistd.h>
+# include <dirent.h>
+#endif
+
+namespace olo {
+using std::runtime_error;
+using boost::format;
+
+namespace {
+const char ENTRY_MAGIC[8] = {'A', '1', 'S', 'T', 'I', 'M', 'U', 'L'};
+const uint32_t ENTRY_VERSION = 2;
+const char* const ENTRY_SUFFIX = ".f32";
+// Frame data starts page-aligned
+const uint64_t ENTRY_DATA_OFFSET = 4096;
+const size_t DECODE_CHUNK_FRAMES = 65536;
+
+// Leading bytes of a cache entry, followed by source_path_length bytes of the source path
+// and interleaved float32 frames at data_offset.
+// Frames are stored contiguously, so seeking to a frame is a multiplication.
+struct EntryHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t channels;
+    uint64_t sample_rate;
+    uint64_t frames;
+    uint64_t data_offset;
+    uint64_t source_size;
+    int64_t source_mtime_ns;
+    uint64_t source_path_length;
+};
+
+#ifndef _WIN32
+// FNV-1a
+uint64_t hash_string(const string& s) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (unsigned char c: s) {
+        hash = (hash ^ c) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+int64_t mtime_ns(const struct stat& st) {
+#ifdef __APPLE__
+    return (int64_t)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+    return (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+}
+
+struct DirCloser {
+    void operator()(DIR* dir) const {
+        closedir(dir);
+    }
+};
+
+void make_dirs(const string& dir) {
+    for (size_t pos = 1; pos <= dir.size(); ++pos) {
+        if (pos == dir.size() || dir[pos] == '/') {
+            auto sub = dir.substr(0, pos);
+            if (mkdir(sub.c_str(), 0755) != 0 && errno != EEXIST) {
+                throw runtime_error{str(format("can't create cache directory %1%: %2%")
+                    % sub % std::strerror(errno))};
+            }
+        }
+    }
+}
+#endif
+}
+
+MappedStimulus::MappedStimulus(const string& path) {
+#ifdef _WIN32
+    throw runtime_error{"playback file cache is not supported on this platform"};
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw runtime_error{str(format("can't open cache entry %1%: %2%") % path % std::strerror(errno))};
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(EntryHeader)) {
+        ::close(fd);
+        throw runtime_error{str(format("cache entry %1% is truncated") % path)};
+    }
+    size_ = st.st_size;
+    addr_ = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (addr_ == MAP_FAILED) {
+        addr_ = nullptr;
+        throw runtime_error{str(format("can't map cache entry %1%: %2%") % path % std::strerror(errno))};
+    }
+    EntryHeader header;
+    std::memcpy(&header, addr_, sizeof(header));
+    const uint64_t data_size = header.frames * header.channels * sizeof(Sample);
+    if (std::memcmp(header.magic, ENTRY_MAGIC, sizeof(ENTRY_MAGIC)) != 0 || header.version != ENTRY_VERSION
+            || header.source_path_length > size_
+            || header.data_offset < sizeof(header) + header.source_path_length
+            || header.data_offset + data_size != size_) {
+        munmap(addr_, size_);
+        throw runtime_error{str(format("cache entry %1% is invalid") % path)};
+    }
+    data_ = reinterpret_cast<const Sample*>(static_cast<const char*>(addr_) + header.data_offset);
+    frame_count_ = header.frames;
+    channel_count_ = header.channels;
+    source_path_.assign(static_cast<const char*>(addr_) + sizeof(header), header.source_path_length);
+    source_size_ = header.source_size;
+    source_mtime_ns_ = header.source_mtime_ns;
+    // Playback reads it front to back
+    madvise(addr_, size_, MADV_SEQUENTIAL);
+#endif
+}
+
+MappedStimulus::~MappedStimulus() {
+#ifndef _WIN32
+    if (addr_) {
+        munmap(addr_, size_);
+    }
+#endif
+}
+
+StimulusCache::StimulusCache(const string& dir, uint64_t size_max):
+    dir_{dir},
+    size_max_{size_max}
+{
+#ifdef _WIN32
+    throw runtime_error{"playback file cache is not supported on this platform"};
+#else
+    make_dirs(dir_);
+#endif
+}
+
+string StimulusCache::default_dir() {
+    const char* xdg = std::getenv("XDG_CACHE_HOME");
+    if (xdg && *xdg) {
+        return string{xdg} + "/arrow1";
+    }
+    const char* home = std::getenv("HOME");
+    return string{home ? home : "."} + "/.cache/arrow1";
+}
+
+bool StimulusCache::worth_caching(const SF_INFO& si) {
+    const int major = si.format & SF_FORMAT_TYPEMASK;
+    const int subtype = si.format & SF_FORMAT_SUBMASK;
+    if (major == SF_FORMAT_FLAC || major == SF_FORMAT_OGG) {
+        return true;
+    }
+    switch (subtype) {
+    case SF_FORMAT_PCM_S8:
+    case SF_FORMAT_PCM_16:
+    case SF_FORMAT_PCM_24:
+    case SF_FORMAT_PCM_32:
+    case SF_FORMAT_PCM_U8:
+    case SF_FORMAT_FLOAT:
+    case SF_FORMAT_DOUBLE:
+        return false;
+    default:
+        return true;
+    }
+}
+
+string StimulusCache::entry_path(const Source& source, size_t sample_rate) const {
+    const auto key = str(format("%1%:%2%:%3%") % source.path % source.size % source.mtime_ns);
+    return str(format("%1%/%2$016x-%3%%4%") % dir_ % hash_string(key) % sample_rate % ENTRY_SUFFIX);
+}
+
+std::unique_ptr<MappedStimulus> StimulusCache::open(const string& path, SNDFILE* sf, const SF_INFO& si, size_t sample_rate) {
+#ifdef _WIN32
+    return nullptr;
+#else
+    // Keyed by what stat() tells, so that a hit doesn't read the source at all
+    struct stat st;
+    std::unique_ptr<char, decltype(&std::free)> real{realpath(path.c_str(), nullptr), std::free};
+    if (!real || stat(real.get(), &st) != 0) {
+        lerror("StimulusCache::open(): can't stat %s: %s, playing from file\n", path.c_str(), std::strerror(errno));
+        return nullptr;
+    }
+    const Source source{real.get(), (uint64_t)st.st_size, mtime_ns(st)};
+    if (sizeof(EntryHeader) + source.path.size() > ENTRY_DATA_OFFSET) {
+        linfo("Path of %s is too long for playback file cache, not caching it\n", path.c_str());
+        return nullptr;
+    }
+    const auto entry = entry_path(source, sample_rate);
+    if (access(entry.c_str(), R_OK) == 0) {
+        try {
+            std::unique_ptr<MappedStimulus> mapped{new MappedStimulus{entry}};
+            if (mapped->source_path() == source.path && mapped->source_size() == source.size
+                    && mapped->source_mtime_ns() == source.mtime_ns
+                    && mapped->channel_count() == (size_t)si.channels && mapped->frame_count() == (size_t)si.frames) {
+                // Mark as recently used
+                utimes(entry.c_str(), nullptr);
+                ldebug("StimulusCache::open(): hit for %s in %s\n", path.c_str(), entry.c_str());
+                return mapped;
+            }
+            lerror("StimulusCache::open(): cache entry %s doesn't match %s, replacing it\n", entry.c_str(), path.c_str());
+        } catch (std::exception& ex) {
+            lerror("StimulusCache::open(): %s, replacing it\n", ex.what());
+        }
+        unlink(entry.c_str());
+    }
+
+    const uint64_t entry_size = ENTRY_DATA_OFFSET + (uint64_t)si.frames * si.channels * sizeof(Sample);
+    if (si.frames <= 0 || entry_size > size_max_) {
+        linfo("Decoded %s takes %llu bytes, more than cache size limit %llu, not caching it\n",
+            path.c_str(), (unsigned long long)entry_size, (unsigned long long)size_max_);
+        return nullptr;
+    }
+    linfo("Decoding %s into playback file cache\n", path.c_str());
+    if (!fill(entry, sf, si, source)) {
+        return nullptr;
+    }
+    evict(entry);
+    return std::unique_ptr<MappedStimulus>{new MappedStimulus{entry}};
+#endif
+}
+
+bool StimulusCache::fill(const string& entry, SNDFILE* sf, const SF_INFO& si, const Source& source) {
+#ifdef _WIN32
+    return false;
+#else
+    // Concurrent runs may fill the same entry, only a complete one gets renamed into place
+    const auto tmp = str(format("%1%.tmp.%2%") % entry % getpid());
+    std::unique_ptr<FILE, decltype(&std::fclose)> f{std::fopen(tmp.c_str(), "wb"), std::fclose};
+    if (!f) {
+        lerror("StimulusCache::fill(): can't create %s: %s\n", tmp.c_str(), std::strerror(errno));
+        return false;
+    }
+    EntryHeader header = {};
+    std::memcpy(header.magic, ENTRY_MAGIC, sizeof(ENTRY_MAGIC));
+    header.version = ENTRY_VERSION;
+    header.channels = si.channels;
+    header.sample_rate = si.samplerate;
+    header.data_offset = ENTRY_DATA_OFFSET;
+    header.source_size = source.size;
+    header.source_mtime_ns = source.mtime_ns;
+    header.source_path_length = source.path.size();
+    std::unique_ptr<Sample[]> buff{new Sample[DECODE_CHUNK_FRAMES * si.channels]};
+    bool ok = std::fwrite(&header, sizeof(header), 1, f.get()) == 1
+        && std::fwrite(source.path.data(), 1, source.path.size(), f.get()) == source.path.size()
+        && std::fseek(f.get(), ENTRY_DATA_OFFSET, SEEK_SET) == 0
+        && sf_seek(sf, 0, SEEK_SET) == 0;
+    sf_count_t read;
+    while (ok && (read = sf_readf_float(sf, buff.get(), DECODE_CHUNK_FRAMES)) > 0) {
+        ok = std::fwrite(buff.get(), sizeof(Sample) * si.channels, read, f.get()) == (size_t)read;
+        header.frames += read;
+    }
+    ok = ok && header.frames == (uint64_t)si.frames;
+    // Frame count goes in last, so that an entry cut short is never valid
+    ok = ok && std::fseek(f.get(), 0, SEEK_SET) == 0
+        && std::fwrite(&header, sizeof(header), 1, f.get()) == 1;
+    ok = std::fclose(f.release()) == 0 && ok;
+    if (!ok || std::rename(tmp.c_str(), entry.c_str()) != 0) {
+        lerror("StimulusCache::fill(): failed writing cache entry %s, playing from file\n", entry.c_str());
+        unlink(tmp.c_str());
+        return false;
+    }
+    ldebug("StimulusCache::fill(): decoded %llu frames into %s\n", (unsigned long long)header.frames, entry.c_str());
+    return true;
+#endif
+}
+
+void StimulusCache::evict(const string& keep) {
+#ifndef _WIN32
+    struct Entry {
+        string path;
+        uint64_t size;
+        time_t mtime;
+    };
+    vector<Entry> entries;
+    uint64_t total = 0;
+    std::unique_ptr<DIR, DirCloser> dir{opendir(dir_.c_str())};
+    if (!dir) {
+        return;
+    }
+    const size_t suffix_len = std::strlen(ENTRY_SUFFIX);
+    while (auto ent = readdir(dir.get())) {
+        string name = ent->d_name;
+        if (name.size() <= suffix_len || name.compare(name.size() - suffix_len, suffix_len, ENTRY_SUFFIX) != 0) {
+            continue;
+        }
+        struct stat st;
+        auto path = dir_ + "/" + name;
+        if (stat(path.c_str(), &st) == 0) {
+            entries.push_back({path, (uint64_t)st.st_size, st.st_mtime});
+            total += st.st_size;
+        }
+    }
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+        return a.mtime < b.mtime;
+    });
+    for (auto& entry: entries) {
+        if (total <= size_max_) {
+            break;
+        }
+        if (entry.path == keep) {
+            continue;
+        }
+        // Runs still playing it keep their mapping
+        if (unlink(entry.path.c_str()) == 0) {
+            ldebug("StimulusCache::evict(): evicted %s\n", entry.path.c_str());
+            total -= entry.size;
+        }
+    }
+#endif
+}
+
+}
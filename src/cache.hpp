@@ -0,0 +1,72 @@
+#pragma once
+#include "types.hpp"
+
+#include <sndfile.h>
+
+#include <memory>
+#include <cstdint>
+
+namespace olo {
+
+// Read-only mapping of a decoded playback file in StimulusCache.
+class MappedStimulus {
+    void* addr_ = nullptr;
+    size_t size_ = 0;
+    const Sample* data_ = nullptr;
+    size_t frame_count_ = 0;
+    size_t channel_count_ = 0;
+    // Identity of the file the entry was decoded from
+    string source_path_;
+    uint64_t source_size_ = 0;
+    int64_t source_mtime_ns_ = 0;
+
+public:
+    // Maps cache entry at `path`, throws if it isn't a valid entry.
+    explicit MappedStimulus(const string& path);
+    ~MappedStimulus();
+
+    MappedStimulus(const MappedStimulus&) = delete;
+    MappedStimulus& operator=(const MappedStimulus&) = delete;
+
+    // Interleaved frames, a frame is found at `data() + frame * channel_count()`
+    const Sample* data() const { return data_; }
+    size_t frame_count() const { return frame_count_; }
+    size_t channel_count() const { return channel_count_; }
+    const string& source_path() const { return source_path_; }
+    uint64_t source_size() const { return source_size_; }
+    int64_t source_mtime_ns() const { return source_mtime_ns_; }
+};
+
+// Keeps decoded playback files on disk as raw interleaved float32, so that
+// compressed files are decoded only once and later read at memory speed.
+// Entries are keyed by file path, size and modification time, and the engine sample rate.
+// Least recently used entries are evicted once the cache outgrows its size limit.
+class StimulusCache {
+    // Playback file as seen by stat(), a change of any of these invalidates its entry
+    struct Source {
+        string path;
+        uint64_t size;
+        int64_t mtime_ns;
+    };
+
+    string dir_;
+    uint64_t size_max_;
+
+    string entry_path(const Source& source, size_t sample_rate) const;
+    bool fill(const string& entry, SNDFILE* sf, const SF_INFO& si, const Source& source);
+    void evict(const string& keep);
+
+public:
+    explicit StimulusCache(const string& dir, uint64_t size_max);
+
+    // $XDG_CACHE_HOME/arrow1 or ~/.cache/arrow1
+    static string default_dir();
+    // Compressed files are the ones worth caching, others decode as fast as we can read them
+    static bool worth_caching(const SF_INFO& si);
+
+    // Returns decoded contents of the file at `path`, already opened as `sf`. On a cache miss
+    // decodes the whole file into the cache first. Returns null if the file can't be cached.
+    std::unique_ptr<MappedStimulus> open(const string& path, SNDFILE* sf, const SF_INFO& si, size_t sample_rate);
+};
+
+}
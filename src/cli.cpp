@@ -4,6 +4,7 @@
 #include <boost/tokenizer.hpp>
 
 #include <iostream>
+#include <algorithm>
 #include <cstdlib>
 
 namespace olo {
@@ -22,20 +23,162 @@ auto split_ports(const vector<string>& ports) {
     return res;
 }
 
+bool parse_cpus(const po::variables_map& vm, const char* option, vector<int>& cpus) {
+    if (vm.count(option) == 0) {
+        return true;
+    }
+    try {
+        for (auto& cpu: split_ports({vm[option].as<string>()})) {
+            cpus.push_back(std::stoi(cpu));
+            if (cpus.back() < 0) {
+                throw std::out_of_range{cpu};
+            }
+        }
+    } catch (std::logic_error&) {
+        std::cerr << "Option --" << option << " requires a comma-separated list of CPU numbers\n";
+        return false;
+    }
+    return true;
+}
+
+bool parse_channels(const po::variables_map& vm, const char* option, vector<size_t>& channels) {
+    if (vm.count(option) == 0) {
+        return true;
+    }
+    try {
+        for (auto& channel: split_ports({vm[option].as<string>()})) {
+            auto n = std::stoi(channel);
+            if (n < 1) {
+                throw std::out_of_range{channel};
+            }
+            channels.push_back(n - 1);
+        }
+    } catch (std::logic_error&) {
+        std::cerr << "Option --" << option << " requires a comma-separated list of channel numbers, starting from 1\n";
+        return false;
+    }
+    return true;
+}
+
+bool parse_mix(const po::variables_map& vm, Args& args) {
+    if (vm.count("preview-mix") == 0) {
+        return true;
+    }
+    try {
+        for (auto& group: split_ports({vm["preview-mix"].as<string>()})) {
+            vector<size_t> channels;
+            boost::tokenizer<boost::char_separator<char>> tok(group, boost::char_separator<char>("+"));
+            for (auto& channel: tok) {
+                auto n = std::stoi(channel);
+                if (n < 1) {
+                    throw std::out_of_range{channel};
+                }
+                channels.push_back(n - 1);
+            }
+            if (channels.empty()) {
+                throw std::out_of_range{group};
+            }
+            args.preview_mix.push_back(channels);
+        }
+    } catch (std::logic_error&) {
+        std::cerr << "Option --preview-mix requires a comma-separated list of preview channels, each a +-separated list of recorded channel numbers starting from 1\n";
+        return false;
+    }
+    if (args.preview_mix.empty() || args.preview_mix.size() > 8) {
+        std::cerr << "Preview must have 1 to 8 channels\n";
+        return false;
+    }
+    return true;
+}
+
+bool parse_loop(const po::variables_map& vm, Args& args) {
+    if (vm.count("loop") == 0) {
+        return true;
+    }
+    auto& loop = vm["loop"].as<string>();
+    if (loop == "inf") {
+        args.loop_count = 0;
+        return true;
+    }
+    try {
+        size_t pos;
+        auto count = std::stoi(loop, &pos);
+        if (pos != loop.size() || count < 1) {
+            throw std::out_of_range{loop};
+        }
+        args.loop_count = count;
+    } catch (std::logic_error&) {
+        std::cerr << "Option --loop requires a positive number of passes or inf\n";
+        return false;
+    }
+    return true;
+}
+
 bool validate(const po::variables_map& vm, Args& args) {
     if (args.show_ports || args.show_version) {
         // These args override any others and disable their validation
         return true;
     }
-    if (args.output_file.empty() && args.input_file.empty()) {
+    const bool playback = !args.input_file.empty() || !args.playlist_file.empty();
+    if (args.soak) {
+        if (!args.output_file.empty() || playback || !args.shm_name.empty() || !args.spectrum_file.empty()) {
+            std::cerr << "Soak test plays and verifies its own signal, it can't be combined with files, --shm or --spectrum\n";
+            return false;
+        }
+        if (vm.count("in") != vm.count("out") || args.input_channel_count) {
+            std::cerr << "Soak test through external loopback requires both --in and --out\n";
+            return false;
+        }
+        if (args.soak_channels == 0) {
+            std::cerr << "Soak test requires at least one channel\n";
+            return false;
+        }
+    } else if (!vm["soak-channels"].defaulted()) {
+        std::cerr << "Option --soak-channels requires --soak\n";
+        return false;
+    }
+    if (args.output_file.empty() && !playback && args.shm_name.empty() && args.spectrum_file.empty() && !args.soak) {
         std::cerr << ABOUT <<
         "\nNo playback or record files specified. Nothing to do!\n";
         return false;
     }
-    if (!args.output_file.empty() && args.input_file.empty() && !args.duration_secs) {
+    if ((!args.output_file.empty() || !args.shm_name.empty() || !args.spectrum_file.empty()) && !playback && !args.duration_secs) {
         std::cerr << "Recording requires a playback file name and/or a duration to be specified\n";
         return false;
     }
+    if (args.flac && (args.output_file.empty() || STDIO_PATH == args.output_file)) {
+        std::cerr << "FLAC recording requires a record file name\n";
+        return false;
+    }
+    if (!args.rt && (args.reader_priority || args.writer_priority
+            || vm.count("reader-cpus") || vm.count("writer-cpus") || !vm["rt-policy"].defaulted())) {
+        std::cerr << "Real-time scheduling options require --rt\n";
+        return false;
+    }
+    if (args.rt_policy != "fifo" && args.rt_policy != "rr") {
+        std::cerr << "Real-time policy must be one of: fifo, rr\n";
+        return false;
+    }
+    if (!parse_cpus(vm, "reader-cpus", args.reader_cpus) || !parse_cpus(vm, "writer-cpus", args.writer_cpus)) {
+        return false;
+    }
+    if (args.spectrum_file.empty()
+            && (!vm["spectrum-size"].defaulted() || !vm["spectrum-rate"].defaulted() || !vm["spectrum-threads"].defaulted())) {
+        std::cerr << "Spectrum options require --spectrum\n";
+        return false;
+    }
+    if (args.spectrum_size < 16 || (args.spectrum_size & (args.spectrum_size - 1)) != 0) {
+        std::cerr << "Spectrum FFT size must be a power of 2 of at least 16\n";
+        return false;
+    }
+    if (args.spectrum_rate <= 0) {
+        std::cerr << "Spectrum rate must be positive\n";
+        return false;
+    }
+    if (args.shm_ring_secs <= 0) {
+        std::cerr << "Shared memory ring length must be positive\n";
+        return false;
+    }
     if (args.input_channel_count && vm.count("in") != 0) {
         std::cerr << "Options --input-channel-count and --in cannot be set at the same time\n";
         return false;
@@ -48,9 +191,119 @@ bool validate(const po::variables_map& vm, Args& args) {
         std::cerr << "Start offset must not be negative\n";
         return false;
     }
+    if (!parse_loop(vm, args)) {
+        return false;
+    }
+    if (!args.loop_count && (args.loop_start_secs || args.loop_end_secs || vm.count("crossfade"))) {
+        std::cerr << "Loop region options require --loop\n";
+        return false;
+    }
+    if (args.loop_count && (args.input_file.empty() || STDIO_PATH == args.input_file)) {
+        std::cerr << "Looping requires a playback file\n";
+        return false;
+    }
+    if ((args.loop_start_secs && *args.loop_start_secs < 0) || (args.loop_end_secs && *args.loop_end_secs < 0)
+            || args.loop_crossfade_secs < 0) {
+        std::cerr << "Loop start, end and crossfade must not be negative\n";
+        return false;
+    }
+    if (!args.cache && (vm.count("cache-dir") || !vm["cache-size"].defaulted())) {
+        std::cerr << "Cache options require --cache\n";
+        return false;
+    }
+    if (args.cache_size_mb == 0) {
+        std::cerr << "Cache size must be positive\n";
+        return false;
+    }
+    if (args.fir_file.empty() && !vm["fir-threads"].defaulted()) {
+        std::cerr << "Filter options require --fir\n";
+        return false;
+    }
+    if (!args.fir_file.empty() && !playback) {
+        std::cerr << "Filtering requires a playback file\n";
+        return false;
+    }
+    if (!args.trigger_dbfs && (vm.count("trigger-channels") || !vm["pre-trigger"].defaulted() || !vm["hold"].defaulted())) {
+        std::cerr << "Trigger options require --trigger\n";
+        return false;
+    }
+    if (args.trigger_dbfs && (args.output_file.empty() || STDIO_PATH == args.output_file)) {
+        std::cerr << "Triggered recording requires a record file name\n";
+        return false;
+    }
+    if (args.pre_trigger_secs < 0 || args.hold_secs <= 0) {
+        std::cerr << "Pre-trigger length must not be negative and hold time must be positive\n";
+        return false;
+    }
+    if (!parse_channels(vm, "trigger-channels", args.trigger_channels)) {
+        return false;
+    }
+    if (args.ram && args.output_file.empty()) {
+        std::cerr << "Recording to memory requires a record file name\n";
+        return false;
+    }
+    if (args.ram && args.trigger_dbfs) {
+        std::cerr << "Options --ram and --trigger cannot be set at the same time\n";
+        return false;
+    }
+    if (args.ram && args.duration_secs && 0 == *args.duration_secs) {
+        std::cerr << "Recording to memory requires a finite duration\n";
+        return false;
+    }
+    if (args.playlist_file.empty() && (!vm["gap"].defaulted() || args.split || vm.count("index"))) {
+        std::cerr << "Playlist options require --playlist\n";
+        return false;
+    }
+    if (!args.playlist_file.empty()) {
+        if (!args.input_file.empty()) {
+            std::cerr << "Options --read-file and --playlist cannot be set at the same time\n";
+            return false;
+        }
+        if (args.loop_count || vm.count("start") || args.cache) {
+            std::cerr << "Playlist can't be combined with --loop, --start or --cache\n";
+            return false;
+        }
+    }
+    if (args.gap_secs < 0) {
+        std::cerr << "Gap must not be negative\n";
+        return false;
+    }
+    if (args.split && (args.output_file.empty() || STDIO_PATH == args.output_file || args.ram || args.trigger_dbfs)) {
+        std::cerr << "Split recording requires a record file name, and can't be combined with --ram or --trigger\n";
+        return false;
+    }
+    if (args.preview_file.empty() && (!vm["preview-rate"].defaulted() || vm.count("preview-mix"))) {
+        std::cerr << "Preview options require --preview\n";
+        return false;
+    }
+    if (!args.preview_file.empty() && (args.output_file.empty() || args.ram || STDIO_PATH == args.preview_file)) {
+        std::cerr << "Preview requires a record file name and a preview file name, and can't be combined with --ram\n";
+        return false;
+    }
+    if (args.preview_rate == 0) {
+        std::cerr << "Preview sample rate must be positive\n";
+        return false;
+    }
+    if (!parse_mix(vm, args)) {
+        return false;
+    }
+    if (args.at_frame && args.on_transport) {
+        std::cerr << "Options --at-frame and --on-transport cannot be set at the same time\n";
+        return false;
+    }
     // For compatibility with comma-separated input
     args.input_ports = split_ports(args.input_ports);
     args.output_ports = split_ports(args.output_ports);
+    if (args.soak && args.input_ports != Args::PORTS_DEFAULT) {
+        if (args.input_ports.size() != args.output_ports.size()) {
+            std::cerr << "Soak test requires as many --in as --out ports, each playback port looped back to a capture one\n";
+            return false;
+        }
+        if (std::find(args.output_ports.begin(), args.output_ports.end(), NULL_OUTPUT) != args.output_ports.end()) {
+            std::cerr << "Soak test can't leave playback ports disconnected\n";
+            return false;
+        }
+    }
     return true;
 }
 }
@@ -79,8 +332,90 @@ Args handle_cli(int argc, char** argv) {
             "Duration of playback and recording in s ; if not set, the duration of playback file will be used ; required for recording without playback ; use 0 to record until terminated with ^C")
         ("start,s", po::value(&args.start_offset_secs),
             "Offset to start at when reading playback file, in s")
-        ("read-file,r", po::value(&args.input_file), "File path to read playback audio data from, in any format supported by libsndfile")
-        ("write-file,w", po::value(&args.output_file), "File path to write recorded audio data to, in wav format ; warning, existing files will be overwritten")
+        ("loop", po::value<string>(),
+            "Play the loop region of playback file this many times in a row, or inf to loop until duration or ^C ; the region is decoded into memory once and wraps around without a gap")
+        ("loop-start", po::value(&args.loop_start_secs),
+            "Start of loop region in playback file in s ; defaults to --start")
+        ("loop-end", po::value(&args.loop_end_secs),
+            "End of loop region in playback file in s ; defaults to end of file")
+        ("crossfade", po::value(&args.loop_crossfade_secs),
+            "Length of equal-power crossfade of loop region end into its start in s ; passes after the first one are shorter by this much")
+        ("cache", po::bool_switch(&args.cache),
+            "Keep compressed playback files (FLAC, Ogg, etc) decoded in an on-disk cache, so that following runs start instantly and read at memory speed")
+        ("cache-dir", po::value(&args.cache_dir),
+            "Directory of playback file cache ; defaults to $XDG_CACHE_HOME/arrow1")
+        ("cache-size", po::value(&args.cache_size_mb)->default_value(args.cache_size_mb),
+            "Size limit of playback file cache in MB ; least recently used files are evicted above it")
+        ("fir", po::value(&args.fir_file),
+            "Convolve playback with impulse responses from this audio file, with a channel per playback channel or a single one for all ; output keeps the playback length")
+        ("fir-threads", po::value(&args.fir_threads)->default_value(args.fir_threads),
+            "Threads convolving playback channels in parallel ; 0 means one per channel up to the number of CPUs")
+        ("trigger", po::value(&args.trigger_dbfs),
+            "Record only events: start recording when input peaks above this level in dBFS, e.g. -30 ; each event goes into its own file, numbered after the record file name, e.g. foo-0001.wav")
+        ("trigger-channels", po::value<string>(),
+            "Comma-separated list of recorded channels watched for trigger, starting from 1 ; defaults to all")
+        ("pre-trigger", po::value(&args.pre_trigger_secs)->default_value(args.pre_trigger_secs),
+            "Length of input preceding the trigger to include in event recording, in s")
+        ("hold", po::value(&args.hold_secs)->default_value(args.hold_secs),
+            "Event recording stops after input stays below trigger level for this long, in s")
+        ("preserve-timeline", po::bool_switch(&args.preserve_timeline),
+            "Keep recording and playback aligned to Jack timeline across xruns: frames which couldn't be recorded are written as silence, and playback frames which couldn't be played in time are skipped")
+        ("xrun-log", po::value(&args.xrun_log),
+            "File path to write a JSON list of xruns to, with their cause, position and duration ; kept up to date while running")
+        ("at-frame", po::value(&args.at_frame),
+            "Start playback and recording exactly at this absolute Jack frame time (as returned by jack_frame_time) ; until then the session is armed and outputs silence")
+        ("on-transport", po::bool_switch(&args.on_transport),
+            "Start playback and recording when Jack transport starts rolling")
+        ("read-file,r", po::value(&args.input_file), "File path to read playback audio data from, in any format supported by libsndfile ; use - to read raw interleaved float32 from stdin")
+        ("playlist", po::value(&args.playlist_file),
+            "Play the audio files listed in this file back to back in one session, one path per line relative to the list ; empty lines and lines starting with # are skipped, so M3U files work ; the next file is opened and its start decoded while the current one plays")
+        ("gap", po::value(&args.gap_secs)->default_value(args.gap_secs),
+            "Silence played after each playlist item, in s")
+        ("split", po::bool_switch(&args.split),
+            "Record each playlist item and the gap after it into its own file, numbered after the record file name, e.g. foo-0001.wav")
+        ("index", po::value(&args.index_file),
+            "File path to write JSON index of playlist items to, with their frame positions and record files ; defaults to the record file name with .index.json extension")
+        ("write-file,w", po::value(&args.output_file), "File path to write recorded audio data to, in wav format ; warning, existing files will be overwritten ; use - to write raw interleaved float32 to stdout")
+        ("ram", po::bool_switch(&args.ram),
+            "Record into locked memory allocated upfront for the whole duration, and write the record file only once done ; no disk activity while recording")
+        ("flac", po::bool_switch(&args.flac),
+            "Write recorded audio data in FLAC format, encoded in parallel ; more than 8 channels are split into files of 8 channels each, suffixed with channel ranges")
+        ("preview", po::value(&args.preview_file),
+            "File path to write a low-rate preview of the recording to while recording, as 16-bit FLAC ; mixed down, filtered and decimated on a thread of its own, which never holds up recording")
+        ("preview-rate", po::value(&args.preview_rate)->default_value(args.preview_rate),
+            "Sample rate of preview in Hz ; rounded to an integer fraction of the Jack sample rate")
+        ("preview-mix", po::value<string>(),
+            "Comma-separated list of preview channels, each a +-separated list of recorded channels averaged into it, starting from 1, e.g. 1+2,3+4 ; defaults to all channels mixed into one")
+        ("encoder-threads", po::value(&args.encoder_threads),
+            "Number of FLAC encoder threads ; each thread encodes whole files of up to 8 channels, so it's at most one per file ; defaults to number of CPUs")
+        ("soak", po::bool_switch(&args.soak),
+            "Soak test: play a signal encoding frame indices through a loopback and verify every captured frame, in memory ; reports dropped, duplicated and corrupt frames, latency drift, xruns and Jack CPU load ; loops own ports back inside Jack unless --in and --out are given")
+        ("soak-channels", po::value(&args.soak_channels)->default_value(args.soak_channels),
+            "Number of channels of soak test through own loopback")
+        ("rt", po::bool_switch(&args.rt),
+            "Real-time hardening: lock process memory, prefault buffers and give I/O threads real-time priority before starting ; settings which can't be applied are reported")
+        ("rt-policy", po::value(&args.rt_policy)->default_value(args.rt_policy),
+            "Scheduling policy of I/O threads with --rt: fifo or rr")
+        ("reader-priority", po::value(&args.reader_priority),
+            "Real-time priority of playback file reader thread with --rt ; defaults to 10 below Jack's")
+        ("writer-priority", po::value(&args.writer_priority),
+            "Real-time priority of record file writer thread with --rt ; defaults to 10 below Jack's")
+        ("reader-cpus", po::value<string>(),
+            "Comma-separated list of CPUs to run playback file reader thread on with --rt")
+        ("writer-cpus", po::value<string>(),
+            "Comma-separated list of CPUs to run record file writer thread on with --rt")
+        ("shm", po::value(&args.shm_name),
+            "Name of POSIX shared memory segment to publish recorded audio data to, live ; use with or instead of --write-file")
+        ("spectrum", po::value(&args.spectrum_file),
+            "File path to keep Welch power spectra of captured channels in, as JSON in dB relative to a full-scale sine ; analysis runs at idle priority and never holds up capture")
+        ("spectrum-size", po::value(&args.spectrum_size)->default_value(args.spectrum_size),
+            "FFT length of spectra, a power of 2 ; Hann-windowed segments overlap by half")
+        ("spectrum-rate", po::value(&args.spectrum_rate)->default_value(args.spectrum_rate),
+            "Number of spectra written per second, each averaged over the segments since the previous one")
+        ("spectrum-threads", po::value(&args.spectrum_threads)->default_value(args.spectrum_threads),
+            "Threads analyzing channels in parallel ; 0 means one per channel up to the number of CPUs")
+        ("shm-length", po::value(&args.shm_ring_secs),
+            "Length of shared memory ring in s")
     ;
     po::positional_options_description pos;
     pos.add("play-file", 1).add("record-file", 1);
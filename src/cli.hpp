@@ -14,9 +14,55 @@ struct Args {
     vector<string> input_ports = PORTS_DEFAULT;
     vector<string> output_ports = PORTS_DEFAULT;
     string input_file;
+    string playlist_file;
+    double gap_secs = 0.;
+    bool split = false;
+    string index_file;
     string output_file;
+    bool flac = false;
+    string preview_file;
+    size_t preview_rate = 8000;
+    // Recorded channels averaged into each preview channel, empty means all into one
+    vector<vector<size_t>> preview_mix;
+    size_t encoder_threads = 0;
+    bool rt = false;
+    string rt_policy = "fifo";
+    optional<int> reader_priority;
+    optional<int> writer_priority;
+    vector<int> reader_cpus;
+    vector<int> writer_cpus;
+    string shm_name;
+    double shm_ring_secs = 10.;
+    string spectrum_file;
+    size_t spectrum_size = 4096;
+    double spectrum_rate = 2.;
+    // 0 means one per captured channel, up to number of CPUs
+    size_t spectrum_threads = 0;
     optional<double> duration_secs;
     double start_offset_secs = 0.;
+    // Number of passes through loop region, 0 means infinite
+    optional<size_t> loop_count;
+    optional<double> loop_start_secs;
+    optional<double> loop_end_secs;
+    double loop_crossfade_secs = 0.;
+    bool cache = false;
+    string cache_dir;
+    size_t cache_size_mb = 4096;
+    string fir_file;
+    // 0 means one per playback channel, up to number of CPUs
+    size_t fir_threads = 0;
+    optional<double> trigger_dbfs;
+    vector<size_t> trigger_channels;
+    double pre_trigger_secs = 1.;
+    double hold_secs = 2.;
+    bool preserve_timeline = false;
+    string xrun_log;
+    bool ram = false;
+    bool soak = false;
+    // Channels of soak test through own loopback, used unless ports are given
+    size_t soak_channels = 2;
+    optional<jack_nframes_t> at_frame;
+    bool on_transport = false;
 };
 
 Args handle_cli(int argc, char** argv);
@@ -0,0 +1,139 @@
+#include "convolver.hpp"
+#include "log.hpp"
+
+#include <sndfile.h>
+#include <boost/format.hpp>
+
+#include <stdexcept>
+#include <cstring>
+
+namespace olo {
+using std::runtime_error;
+using boost::format;
+
+Convolver::Channel::Channel(size_t block_frames, size_t partition_count):
+    fft{2 * block_frames},
+    input(2 * block_frames),
+    fdl_re(partition_count * fft.bins()),
+    fdl_im(partition_count * fft.bins()),
+    filter_re(partition_count * fft.bins()),
+    filter_im(partition_count * fft.bins()),
+    acc_re(fft.bins()),
+    acc_im(fft.bins()),
+    output(2 * block_frames)
+{
+}
+
+Convolver::Convolver(const vector<vector<Sample>>& filters, size_t block_frames, size_t thread_count):
+    channel_count_{filters.size()},
+    block_frames_{block_frames},
+    partition_count_{1},
+    pool_{std::max<size_t>(std::min(thread_count, filters.size()), 1) - 1}
+{
+    for (auto& filter: filters) {
+        partition_count_ = std::max(partition_count_, (filter.size() + block_frames_ - 1) / block_frames_);
+    }
+    vector<float> partition(2 * block_frames_);
+    for (auto& filter: filters) {
+        channels_.emplace_back(new Channel{block_frames_, partition_count_});
+        auto& channel = *channels_.back();
+        const size_t bins = channel.fft.bins();
+        for (size_t p = 0; p != partition_count_; ++p) {
+            // Partition padded with zeros to FFT size
+            std::fill(partition.begin(), partition.end(), 0.f);
+            const size_t begin = std::min(p * block_frames_, filter.size());
+            const size_t end = std::min(begin + block_frames_, filter.size());
+            std::copy(filter.begin() + begin, filter.begin() + end, partition.begin());
+            float* re = &channel.filter_re[p * bins];
+            float* im = &channel.filter_im[p * bins];
+            channel.fft.forward(partition.data(), re, im);
+            for (size_t k = 0; k != bins; ++k) {
+                re[k] /= channel.fft.size();
+                im[k] /= channel.fft.size();
+            }
+        }
+    }
+    ldebug("Convolver::Convolver(): %zd channels, %zd partitions of %zd frames, %zd threads\n",
+        channel_count_, partition_count_, block_frames_, pool_.threads().size() + 1);
+}
+
+void Convolver::process_channel(Channel& channel, Sample* frames, size_t c) {
+    const size_t bins = channel.fft.bins();
+    // Overlap-save: transform previous and current block together
+    std::memmove(channel.input.data(), channel.input.data() + block_frames_, block_frames_ * sizeof(float));
+    float* current = channel.input.data() + block_frames_;
+    for (size_t n = 0; n != block_frames_; ++n) {
+        current[n] = frames[n * channel_count_ + c];
+    }
+    channel.fdl_pos = (channel.fdl_pos + partition_count_ - 1) % partition_count_;
+    channel.fft.forward(channel.input.data(), &channel.fdl_re[channel.fdl_pos * bins], &channel.fdl_im[channel.fdl_pos * bins]);
+
+    float* acc_re = channel.acc_re.data();
+    float* acc_im = channel.acc_im.data();
+    std::fill(channel.acc_re.begin(), channel.acc_re.end(), 0.f);
+    std::fill(channel.acc_im.begin(), channel.acc_im.end(), 0.f);
+    // Input block delayed by p blocks meets filter partition p
+    for (size_t p = 0; p != partition_count_; ++p) {
+        const size_t slot = (channel.fdl_pos + p) % partition_count_;
+        const float* x_re = &channel.fdl_re[slot * bins];
+        const float* x_im = &channel.fdl_im[slot * bins];
+        const float* h_re = &channel.filter_re[p * bins];
+        const float* h_im = &channel.filter_im[p * bins];
+        for (size_t k = 0; k != bins; ++k) {
+            acc_re[k] += x_re[k] * h_re[k] - x_im[k] * h_im[k];
+            acc_im[k] += x_re[k] * h_im[k] + x_im[k] * h_re[k];
+        }
+    }
+    channel.fft.inverse(acc_re, acc_im, channel.output.data());
+    // First half is aliased by circular convolution, second one is valid
+    const float* valid = channel.output.data() + block_frames_;
+    for (size_t n = 0; n != block_frames_; ++n) {
+        frames[n * channel_count_ + c] = valid[n];
+    }
+}
+
+void Convolver::process(Sample* frames) {
+    pool_.run(channel_count_, [&](size_t c) {
+        process_channel(*channels_[c], frames, c);
+    });
+}
+
+vector<vector<Sample>> load_filters(const string& path, size_t sample_rate, size_t channel_count) {
+    SF_INFO si = {0};
+    std::unique_ptr<SNDFILE, decltype(&sf_close)> sf {
+        sf_open(path.c_str(), SFM_READ, &si),
+        sf_close
+    };
+    if (!sf) {
+        throw runtime_error{str(format("can't open filter file: %1%") % path)};
+    }
+    if ((size_t)si.samplerate != sample_rate) {
+        throw runtime_error{str(format("filter file sample rate: %1%; engine sample rate: %2%")
+            % si.samplerate % sample_rate)};
+    }
+    if ((size_t)si.channels != channel_count && si.channels != 1) {
+        throw runtime_error{str(format("filter file channels: %1%; playback channels: %2%")
+            % si.channels % channel_count)};
+    }
+    if (si.frames <= 0) {
+        throw runtime_error{str(format("filter file is empty: %1%") % path)};
+    }
+    vector<Sample> interleaved(si.frames * si.channels);
+    sf_count_t read = sf_readf_float(sf.get(), interleaved.data(), si.frames);
+    if (read != si.frames) {
+        throw runtime_error{str(format("unexpected read of %1% frames when requested %2% from filter file")
+            % read % si.frames)};
+    }
+    vector<vector<Sample>> filters(channel_count, vector<Sample>(si.frames));
+    for (size_t c = 0; c != channel_count; ++c) {
+        const size_t src = si.channels == 1 ? 0 : c;
+        for (sf_count_t n = 0; n != si.frames; ++n) {
+            filters[c][n] = interleaved[n * si.channels + src];
+        }
+    }
+    ldebug("load_filters(): %zd frames long filters for %zd channels from %s\n",
+        (size_t)si.frames, channel_count, path.c_str());
+    return filters;
+}
+
+}
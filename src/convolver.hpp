@@ -0,0 +1,56 @@
+#pragma once
+#include "types.hpp"
+#include "fft.hpp"
+#include "pool.hpp"
+
+#include <memory>
+
+namespace olo {
+
+// FIR filter per playback channel, applied to blocks of interleaved frames with
+// uniformly partitioned overlap-save FFT convolution. Filters are split into
+// partitions of the block length, whose spectra are multiplied with a delay
+// line of input block spectra; channels are processed in parallel.
+class Convolver {
+    struct Channel {
+        explicit Channel(size_t block_frames, size_t partition_count);
+
+        RealFft fft;
+        // Previous and current input block
+        vector<float> input;
+        // Spectra of the last partition_count input blocks, newest at fdl_pos
+        vector<float> fdl_re;
+        vector<float> fdl_im;
+        size_t fdl_pos = 0;
+        // Spectra of filter partitions, scaled to normalize the inverse FFT
+        vector<float> filter_re;
+        vector<float> filter_im;
+        vector<float> acc_re;
+        vector<float> acc_im;
+        vector<float> output;
+    };
+
+    size_t channel_count_;
+    size_t block_frames_;
+    size_t partition_count_;
+    vector<std::unique_ptr<Channel>> channels_;
+    ThreadPool pool_;
+
+    void process_channel(Channel& channel, Sample* frames, size_t c);
+
+public:
+    // `filters` holds an impulse response per channel, `thread_count` includes the calling thread.
+    explicit Convolver(const vector<vector<Sample>>& filters, size_t block_frames, size_t thread_count);
+
+    size_t block_frames() const { return block_frames_; }
+    size_t channel_count() const { return channel_count_; }
+    ThreadPool& pool() { return pool_; }
+
+    // Filters a block of block_frames() interleaved frames in place.
+    void process(Sample* frames);
+};
+
+// Loads filters for `channel_count` channels from an audio file with either as many channels, or a single one used for all.
+vector<vector<Sample>> load_filters(const string& path, size_t sample_rate, size_t channel_count);
+
+}
@@ -0,0 +1,215 @@
+#include "encoder.hpp"
+#include "io.hpp"
+#include "log.hpp"
+
+#include <boost/format.hpp>
+
+#include <stdexcept>
+#include <chrono>
+#include <fstream>
+#include <cstring>
+#include <cassert>
+
+namespace olo {
+using std::runtime_error;
+using boost::format;
+
+namespace {
+// foo/bar.flac -> foo/bar.ch09-16.flac
+string group_path(const string& path, size_t first, size_t count) {
+    const auto stem = replace_extension(path, "");
+    return stem + str(format(".ch%02d-%02d") % (first + 1) % (first + count)) + path.substr(stem.size());
+}
+}
+
+const size_t ParallelEncoder::GROUP_CHANNELS_MAX;
+
+ParallelEncoder::ParallelEncoder(
+    const string& path,
+    size_t sample_rate,
+    size_t channel_count,
+    size_t block_frames,
+    size_t thread_count,
+    size_t block_count
+):
+    channel_count_{channel_count},
+    block_frames_{block_frames},
+    blocks_(std::max<size_t>(block_count, 2))
+{
+    size_t group_count = (channel_count_ + GROUP_CHANNELS_MAX - 1) / GROUP_CHANNELS_MAX;
+    groups_.resize(group_count);
+    for (size_t g = 0; g != group_count; ++g) {
+        auto& group = groups_[g];
+        group.first_channel = g * GROUP_CHANNELS_MAX;
+        group.channel_count = std::min(GROUP_CHANNELS_MAX, channel_count_ - group.first_channel);
+        group.path = group_count == 1 ? path : group_path(path, group.first_channel, group.channel_count);
+        SF_INFO si = {0};
+        si.channels = group.channel_count;
+        si.samplerate = sample_rate;
+        si.format = SF_FORMAT_FLAC | SF_FORMAT_PCM_24;
+        group.sf.reset(sf_open(group.path.c_str(), SFM_WRITE, &si));
+        if (!group.sf) {
+            throw runtime_error{str(format("can't open recording file: %1%") % group.path)};
+        }
+        ldebug("ParallelEncoder: encoding channels %zd-%zd to %s\n",
+            group.first_channel + 1, group.first_channel + group.channel_count, group.path.c_str());
+    }
+    for (auto& block: blocks_) {
+        block.data.reset(new Sample[block_frames_ * channel_count_]);
+        free_.push_back(&block);
+    }
+    lanes_.resize(std::max<size_t>(1, std::min(thread_count, group_count)));
+    for (size_t g = 0; g != group_count; ++g) {
+        lanes_[g % lanes_.size()].groups.push_back(&groups_[g]);
+    }
+    for (auto& lane: lanes_) {
+        lane.scratch.reset(new Sample[block_frames_ * GROUP_CHANNELS_MAX]);
+    }
+    for (auto& lane: lanes_) {
+        lane.thread = std::thread(&ParallelEncoder::encode, this, std::ref(lane));
+    }
+    ldebug("ParallelEncoder: %zd files on %zd threads, %zd blocks of %zd frames\n",
+        groups_.size(), lanes_.size(), blocks_.size(), block_frames_);
+}
+
+ParallelEncoder::~ParallelEncoder() {
+    {
+        std::lock_guard<std::mutex> lock{mx_};
+        closing_ = true;
+    }
+    work_cv_.notify_all();
+    for (auto& lane: lanes_) {
+        if (lane.thread.joinable()) {
+            lane.thread.join();
+        }
+    }
+}
+
+void ParallelEncoder::rethrow() {
+    if (ex_) {
+        std::exception_ptr ex;
+        std::swap(ex_, ex);
+        std::rethrow_exception(ex);
+    }
+}
+
+void ParallelEncoder::write(const Sample* frames, size_t frame_count) {
+    while (frame_count != 0) {
+        if (current_ == nullptr) {
+            std::unique_lock<std::mutex> lock{mx_};
+            if (free_.empty() && !ex_) {
+                auto start = std::chrono::steady_clock::now();
+                free_cv_.wait(lock, [this] { return !free_.empty() || ex_; });
+                ++stalls_;
+                stall_secs_ += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            }
+            rethrow();
+            current_ = free_.front();
+            free_.pop_front();
+            current_->frames = 0;
+        }
+        size_t count = std::min(frame_count, block_frames_ - current_->frames);
+        std::memcpy(&current_->data[current_->frames * channel_count_], frames,
+            count * channel_count_ * sizeof(Sample));
+        current_->frames += count;
+        frames += count * channel_count_;
+        frame_count -= count;
+        if (current_->frames == block_frames_) {
+            submit();
+        }
+    }
+}
+
+void ParallelEncoder::submit() {
+    assert(current_ != nullptr);
+    {
+        std::lock_guard<std::mutex> lock{mx_};
+        current_->pending = lanes_.size();
+        for (auto& lane: lanes_) {
+            lane.queue.push_back(current_);
+        }
+    }
+    current_ = nullptr;
+    work_cv_.notify_all();
+}
+
+void ParallelEncoder::encode(Lane& lane) {
+    std::unique_lock<std::mutex> lock{mx_};
+    while (true) {
+        work_cv_.wait(lock, [&] { return !lane.queue.empty() || closing_; });
+        if (lane.queue.empty()) {
+            break;
+        }
+        Block* block = lane.queue.front();
+        lane.queue.pop_front();
+        bool failed = ex_ != nullptr;
+        lock.unlock();
+
+        if (!failed) {
+            try {
+                for (auto group: lane.groups) {
+                    // Pick group's channels out of the interleaved block
+                    const Sample* src = &block->data[group->first_channel];
+                    Sample* dst = lane.scratch.get();
+                    for (size_t n = 0; n != block->frames; ++n) {
+                        std::memcpy(dst, src, group->channel_count * sizeof(Sample));
+                        src += channel_count_;
+                        dst += group->channel_count;
+                    }
+                    auto written = sf_writef_float(group->sf.get(), lane.scratch.get(), block->frames);
+                    if (written != static_cast<sf_count_t>(block->frames)) {
+                        throw runtime_error{str(format("unexpected write of %1% frames when requested %2% to %3%")
+                            % written % block->frames % group->path)};
+                    }
+                }
+            } catch (...) {
+                lerror("ParallelEncoder::encode(): exception in encoder thread, will be rethrown on write()\n");
+                lock.lock();
+                ex_ = std::current_exception();
+                lock.unlock();
+            }
+        }
+
+        lock.lock();
+        if (--block->pending == 0) {
+            free_.push_back(block);
+            free_cv_.notify_one();
+        }
+    }
+}
+
+void ParallelEncoder::close() {
+    if (current_ != nullptr && current_->frames != 0) {
+        submit();
+    }
+    {
+        std::lock_guard<std::mutex> lock{mx_};
+        closing_ = true;
+    }
+    work_cv_.notify_all();
+    for (auto& lane: lanes_) {
+        if (lane.thread.joinable()) {
+            lane.thread.join();
+        }
+    }
+    rethrow();
+    for (auto& group: groups_) {
+        group.sf.reset();
+    }
+    if (stalls_ != 0) {
+        linfo("ParallelEncoder::close(): waited %zd times for encoders, %.3fs in total\n", stalls_, stall_secs_);
+    }
+}
+
+size_t ParallelEncoder::bytes_written() const {
+    size_t res = 0;
+    for (auto& group: groups_) {
+        std::ifstream f{group.path, std::ios::binary | std::ios::ate};
+        if (f) {
+            res += f.tellg();
+        }
+    }
+    return res;
+}
+
+}
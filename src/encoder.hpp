@@ -0,0 +1,90 @@
+#pragma once
+#include "types.hpp"
+
+#include <sndfile.h>
+
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+
+namespace olo {
+
+// Encodes recorded frames to FLAC files on a pool of threads. FLAC streams hold
+// at most 8 channels, so channels are split into groups of up to 8, each
+// encoded into its own file. Groups are distributed over encoder threads, the
+// frames are passed in fixed-size blocks drawn from a bounded pool; when all
+// blocks are in flight, write() waits for the encoders (backpressure).
+class ParallelEncoder {
+    struct Block {
+        std::unique_ptr<Sample[]> data;
+        size_t frames = 0;
+        // Number of lanes which haven't encoded this block yet
+        size_t pending = 0;
+    };
+    struct Group {
+        string path;
+        size_t first_channel;
+        size_t channel_count;
+        std::unique_ptr<SNDFILE, decltype(&sf_close)> sf {nullptr, sf_close};
+    };
+    // Encoder thread with the groups it owns and its queue of blocks.
+    struct Lane {
+        vector<Group*> groups;
+        std::deque<Block*> queue;
+        std::unique_ptr<Sample[]> scratch;
+        std::thread thread;
+    };
+
+    size_t channel_count_;
+    size_t block_frames_;
+    vector<Group> groups_;
+    vector<Lane> lanes_;
+    vector<Block> blocks_;
+    std::deque<Block*> free_;
+    // Block being filled by write()
+    Block* current_ = nullptr;
+    std::mutex mx_;
+    std::condition_variable work_cv_;
+    std::condition_variable free_cv_;
+    bool closing_ = false;
+    std::exception_ptr ex_;
+    size_t stalls_ = 0;
+    double stall_secs_ = 0;
+
+    void submit();
+    void encode(Lane& lane);
+    void rethrow();
+
+public:
+    static const size_t GROUP_CHANNELS_MAX = 8;
+
+    explicit ParallelEncoder(
+        const string& path,
+        size_t sample_rate,
+        size_t channel_count,
+        size_t block_frames,
+        size_t thread_count,
+        size_t block_count = 4
+    );
+    ~ParallelEncoder();
+
+    ParallelEncoder(const ParallelEncoder&) = delete;
+    ParallelEncoder& operator=(const ParallelEncoder&) = delete;
+
+    // Queues interleaved frames for encoding, may block if encoders fall behind.
+    void write(const Sample* frames, size_t frame_count);
+    // Encodes remaining frames, finalizes files and rethrows encoder errors.
+    void close();
+
+    size_t file_count() const { return groups_.size(); }
+    // Number of times write() had to wait for a free block and total time spent waiting.
+    size_t stalls() const { return stalls_; }
+    double stall_secs() const { return stall_secs_; }
+    // Total size of encoded files, valid after close().
+    size_t bytes_written() const;
+};
+
+}
@@ -0,0 +1,106 @@
+#include "fft.hpp"
+
+#include <boost/format.hpp>
+
+#include <stdexcept>
+#include <cmath>
+
+namespace olo {
+using std::runtime_error;
+using boost::format;
+
+namespace {
+const double TWO_PI = 6.28318530717958647692;
+}
+
+RealFft::RealFft(size_t size):
+    size_{size},
+    half_{size / 2},
+    twiddles_(half_ / 2),
+    split_(half_),
+    bitrev_(half_),
+    work_(half_)
+{
+    if (size_ < 4 || (size_ & (size_ - 1)) != 0) {
+        throw runtime_error{str(format("FFT size %1% is not a power of 2 of at least 4") % size_)};
+    }
+    for (size_t k = 0; k != twiddles_.size(); ++k) {
+        twiddles_[k] = std::polar(1., -TWO_PI * k / half_);
+    }
+    for (size_t k = 0; k != split_.size(); ++k) {
+        split_[k] = std::polar(1., -TWO_PI * k / size_);
+    }
+    size_t bits = 0;
+    while ((size_t(1) << bits) < half_) {
+        ++bits;
+    }
+    for (size_t k = 0; k != half_; ++k) {
+        size_t r = 0;
+        for (size_t b = 0; b != bits; ++b) {
+            r |= ((k >> b) & 1) << (bits - 1 - b);
+        }
+        bitrev_[k] = r;
+    }
+}
+
+void RealFft::transform(bool inverse) {
+    for (size_t k = 0; k != half_; ++k) {
+        if (k < bitrev_[k]) {
+            std::swap(work_[k], work_[bitrev_[k]]);
+        }
+    }
+    for (size_t len = 2; len <= half_; len <<= 1) {
+        const size_t step = half_ / len;
+        for (size_t start = 0; start != half_; start += len) {
+            for (size_t j = 0; j != len / 2; ++j) {
+                Complex w = twiddles_[j * step];
+                if (inverse) {
+                    w = std::conj(w);
+                }
+                const Complex a = work_[start + j];
+                const Complex b = work_[start + j + len / 2] * w;
+                work_[start + j] = a + b;
+                work_[start + j + len / 2] = a - b;
+            }
+        }
+    }
+}
+
+void RealFft::forward(const float* in, float* re, float* im) {
+    // Even samples go into real parts, odd ones into imaginary parts
+    for (size_t k = 0; k != half_; ++k) {
+        work_[k] = Complex{in[2 * k], in[2 * k + 1]};
+    }
+    transform(false);
+    const Complex z0 = work_[0];
+    re[0] = z0.real() + z0.imag();
+    im[0] = 0;
+    re[half_] = z0.real() - z0.imag();
+    im[half_] = 0;
+    for (size_t k = 1; k != half_; ++k) {
+        const Complex a = work_[k];
+        const Complex b = std::conj(work_[half_ - k]);
+        const Complex even = (a + b) * .5f;
+        const Complex odd = (a - b) * Complex{0, -.5f};
+        const Complex x = even + split_[k] * odd;
+        re[k] = x.real();
+        im[k] = x.imag();
+    }
+}
+
+void RealFft::inverse(const float* re, const float* im, float* out) {
+    for (size_t k = 0; k != half_; ++k) {
+        const Complex a{re[k], im[k]};
+        const Complex b = std::conj(Complex{re[half_ - k], im[half_ - k]});
+        const Complex even = a + b;
+        const Complex odd = (a - b) * std::conj(split_[k]);
+        work_[k] = even + Complex{0, 1} * odd;
+    }
+    transform(true);
+    for (size_t k = 0; k != half_; ++k) {
+        out[2 * k] = work_[k].real();
+        out[2 * k + 1] = work_[k].imag();
+    }
+}
+
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include "types.hpp"
+
+#include <complex>
+
+namespace olo {
+
+// FFT of real signals of a fixed power of 2 size, computed with a complex FFT
+// of half the size. Spectra are kept as separate real & imaginary arrays of
+// bins() values, which keeps loops over them easy to vectorize.
+class RealFft {
+    using Complex = std::complex<float>;
+
+    size_t size_;
+    size_t half_;
+    // exp(-2*pi*i*k/half_) for butterflies of the half size complex FFT
+    vector<Complex> twiddles_;
+    // exp(-2*pi*i*k/size_) for splitting the half size spectrum into the real one
+    vector<Complex> split_;
+    vector<size_t> bitrev_;
+    vector<Complex> work_;
+
+    void transform(bool inverse);
+
+public:
+    explicit RealFft(size_t size);
+
+    size_t size() const { return size_; }
+    size_t bins() const { return half_ + 1; }
+
+    // Spectrum of size() samples of `in` into bins() values of `re` & `im`.
+    void forward(const float* in, float* re, float* im);
+    // Inverse of forward() scaled by size(), i.e. not normalized.
+    void inverse(const float* re, const float* im, float* out);
+};
+
+}
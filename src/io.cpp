@@ -1,20 +1,61 @@
 #include "io.hpp"
 #include "log.hpp"
+#include "encoder.hpp"
+#include "cache.hpp"
+#include "convolver.hpp"
+#include "playlist.hpp"
+#include "preview.hpp"
+#include "trigger.hpp"
 
 #include <sndfile.h>
 #include <boost/format.hpp>
 
 #include <stdexcept>
 #include <cstring>
+#include <cmath>
 #include <cassert>
+#include <chrono>
+#include <limits>
+#include <cerrno>
+
+#ifndef _WIN32
+# include <poll.h>
+# include <unistd.h>
+#endif
 
 namespace olo {
 using std::runtime_error;
 using boost::format;
 
 namespace {
-auto open_sndfile(const string& path, int mode, SF_INFO& si) {
-    std::unique_ptr<SNDFILE, decltype(&sf_close)> sf {
+const double HALF_PI = 1.57079632679489661923;
+// Gaps in recording posted by RT thread and not yet filled by Writer
+const size_t GAPS_MAX = 1024;
+// Size of chunks gaps are filled with
+const size_t SILENCE_FRAMES = 1024;
+// Jack periods read upfront when starting fast
+const size_t PREFILL_PERIODS = 4;
+// Reading slower than this multiple of real time prefills the whole ringbuffer
+const double PREFILL_SPEED_MIN = 2.;
+// Margin on top of prefilled periods, in multiples of the slowest period read
+const double PREFILL_STALL_FACTOR = 4.;
+// How often a reader waiting for stdin checks for a stop request
+const int STDIN_POLL_MS = 100;
+
+double seconds_since(std::chrono::steady_clock::time_point begin) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+}
+
+void init_stdio_info(SF_INFO& si, size_t sample_rate, size_t channel_count) {
+    si.samplerate = sample_rate;
+    si.channels = channel_count;
+    si.format = SF_FORMAT_RAW | SF_FORMAT_FLOAT | SF_ENDIAN_CPU;
+}
+
+SndfilePtr open_sndfile(const string& path, int mode, SF_INFO& si) {
+    // libsndfile maps "-" to stdin/stdout on its own
+    SndfilePtr sf {
         sf_open(path.c_str(), mode, &si),
         sf_close
     };
@@ -28,6 +69,17 @@ auto open_sndfile(const string& path, int mode, SF_INFO& si) {
     }
     return sf;
 }
+
+string replace_extension(const string& path, const string& suffix) {
+    const auto ext = path.find_last_of('.');
+    const auto dir = path.find_last_of("/\\");
+    const bool has_ext = ext != string::npos && (dir == string::npos || ext > dir);
+    return (has_ext ? path.substr(0, ext) : path) + suffix;
+}
+
+string numbered_path(const string& path, size_t number) {
+    const auto stem = replace_extension(path, "");
+    return stem + str(format("-%04d") % number) + path.substr(stem.size());
 }
 
 IoWorker::IoWorker(size_t sample_rate, size_t channel_count, size_t buffer_size):
@@ -39,7 +91,7 @@ IoWorker::IoWorker(size_t sample_rate, size_t channel_count, size_t buffer_size)
         jack_ringbuffer_create(buffer_size_ * frame_size_),
         &jack_ringbuffer_free
     },
-    buff_{new Sample[buffer_size_ * channel_count_]},
+    frame_{new Sample[channel_count_]},
     sf_ {nullptr, sf_close}
 {
     if (!ring_) {
@@ -79,8 +131,12 @@ void IoWorker::stop() {
 void IoWorker::pump() {
     try {
         std::unique_lock<std::mutex> lock{mx_};
+        bool wait = !eager_start_;
         while (!break_) {
-            cv_.wait(lock);
+            if (wait) {
+                cv_.wait(lock);
+            }
+            wait = true;
             if (break_) {
                 break;
             }
@@ -91,6 +147,8 @@ void IoWorker::pump() {
 
             lock.lock();
         }
+        lock.unlock();
+        flush();
     } catch (...) {
         lerror("IoWorker::pump(): exception in worker thread, will be rethrown on join()\n");
         ex_ = std::current_exception();
@@ -107,12 +165,27 @@ Reader::Reader(
     size_t channel_count,
     size_t buffer_size,
     double duration_secs,
-    double start_offset_secs
+    double start_offset_secs,
+    const optional<LoopRegion>& loop,
+    StimulusCache* cache,
+    Convolver* convolver,
+    size_t period_frames
 ):
-    IoWorker{sample_rate, channel_count, buffer_size}
+    IoWorker{sample_rate, channel_count, buffer_size},
+    convolver_{convolver}
 {
+    check_convolver();
     SF_INFO si = {0};
-    sf_ = open_sndfile(path, SFM_READ, si);
+    const bool stdio = STDIO_PATH == path;
+    if (stdio) {
+        init_stdio_info(si, sample_rate_, channel_count_);
+    }
+#ifndef _WIN32
+    stdin_ = stdio;
+#endif
+    if (!stdin_) {
+        sf_ = open_sndfile(path, SFM_READ, si);
+    }
     if (si.samplerate != sample_rate_) {
         throw runtime_error{str(format("playback file sample rate: %1%; engine sample rate: %2%")
             % si.samplerate % sample_rate_)};
@@ -122,52 +195,400 @@ Reader::Reader(
             % si.channels % channel_count_)};
     }
     ldebug("Reader: reading from %s with %zd sample rate and %zd channels\n",
-        path.c_str(), sample_rate_, channel_count_);
-    sf_count_t frames_avail = si.frames;
+        stdio ? "stdin" : path.c_str(), sample_rate_, channel_count_);
     sf_count_t start_frame = start_offset_secs * sample_rate_ + .5;
-    start_frame = std::min(frames_avail, start_frame);
-    if (sf_seek(sf_.get(), start_frame, SEEK_SET) < 0) {
-        throw runtime_error{str(format("failed seeking input file to frame %1%")
-            % start_frame)};
+    sf_count_t duration_frames = duration_secs * sample_rate_ + .5;
+    if (stdio && loop) {
+        throw runtime_error{"looping requires a playback file, can't loop stdin"};
+    }
+    if (stdio) {
+        // Length of a stream is unknown upfront, play until it ends unless limited by duration
+        skip(start_frame);
+        needed_ = duration_frames;
+    } else {
+        sf_count_t frames_avail = si.frames;
+        start_frame = std::min(frames_avail, start_frame);
+        if (cache && StimulusCache::worth_caching(si)) {
+            mapped_ = cache->open(path, sf_.get(), si, sample_rate_);
+            if (mapped_) {
+                // Everything is read from the mapping from now on
+                sf_.reset();
+            }
+        }
+        if (loop) {
+            load_loop(start_frame, frames_avail, *loop);
+            if (duration_frames != 0) {
+                needed_ = needed_ != 0 ? std::min<size_t>(needed_, duration_frames) : duration_frames;
+                ldebug("Reader::Reader(): limiting duration to %zd frames\n", needed_);
+            }
+        } else {
+            if (!mapped_ && sf_seek(sf_.get(), start_frame, SEEK_SET) < 0) {
+                throw runtime_error{str(format("failed seeking input file to frame %1%")
+                    % start_frame)};
+            }
+            frames_avail -= start_frame;
+            if (duration_frames != 0) {
+                frames_avail = std::min(frames_avail, duration_frames);
+                ldebug("Reader::Reader(): limiting duration to %zd frames\n", frames_avail);
+            }
+            needed_ = frames_avail;
+            if (mapped_) {
+                memory_ = mapped_->data() + start_frame * channel_count_;
+                memory_frames_ = frames_avail;
+                passes_left_ = 1;
+            }
+        }
+    }
+
+    start(period_frames);
+}
+
+Reader::Reader(
+    Playlist& playlist,
+    size_t sample_rate,
+    size_t channel_count,
+    size_t buffer_size,
+    double duration_secs,
+    Convolver* convolver,
+    size_t period_frames
+):
+    IoWorker{sample_rate, channel_count, buffer_size},
+    playlist_{&playlist},
+    convolver_{convolver}
+{
+    check_convolver();
+    needed_ = playlist_->frame_count();
+    const size_t duration_frames = duration_secs * sample_rate_ + .5;
+    if (duration_frames != 0) {
+        needed_ = std::min(needed_, duration_frames);
+        ldebug("Reader::Reader(): limiting duration to %zd frames\n", needed_);
     }
-    frames_avail -= start_frame;
-    if (duration_secs != 0) {
-        sf_count_t duration_frames = duration_secs * sample_rate_ + .5;
-        frames_avail = std::min(frames_avail, duration_frames);
-        ldebug("Reader::Reader(): limiting duration to %zd frames\n", frames_avail);
+    ldebug("Reader: reading %zd playlist items with %zd sample rate and %zd channels\n",
+        playlist_->items().size(), sample_rate_, channel_count_);
+    start(period_frames);
+}
+
+void Reader::check_convolver() {
+    if (!convolver_) {
+        return;
     }
-    needed_ = frames_avail;
+    if (convolver_->channel_count() != channel_count_) {
+        throw runtime_error{str(format("filter channels: %1%; engine channels: %2%")
+            % convolver_->channel_count() % channel_count_)};
+    }
+    if (convolver_->block_frames() > buffer_size_) {
+        throw runtime_error{str(format("filter block of %1% frames doesn't fit ring buffer of %2% frames")
+            % convolver_->block_frames() % buffer_size_)};
+    }
+    block_.resize(convolver_->block_frames() * channel_count_);
+}
 
-    // Prefill ringbuffer with as much input file data as possible to minimize underrun probability.
-    work_cycle();
+void Reader::start(size_t period_frames) {
+    const auto begin = std::chrono::steady_clock::now();
+    if (period_frames != 0) {
+        prefill(period_frames);
+    } else {
+        // Prefill ringbuffer with as much input file data as possible to minimize underrun probability.
+        work_cycle();
+    }
+    prefill_frames_ = done_;
+    prefill_secs_ = seconds_since(begin);
+    ldebug("Reader::Reader(): prefilled %zd frames in %.3f ms\n", prefill_frames_, prefill_secs_ * 1000.);
 
     if (!break_) {
+        // Worker fills the rest of the ringbuffer right away, while ports are set up
+        eager_start_ = true;
         thread_.reset(new std::thread(&Reader::pump, this));
     } else {
         ldebug("Reader::Reader(): not starting worker, whole file in ringbuffer\n");
     }
 }
 
+Reader::~Reader() {
+    stop();
+}
+
+void Reader::prefill(size_t period_frames) {
+    // Read a few periods one at a time, measuring how fast the source delivers
+    const size_t target = std::min(buffer_size_, PREFILL_PERIODS * period_frames);
+    const auto begin = std::chrono::steady_clock::now();
+    double slowest_secs = 0.;
+    while (!break_ && done_ < target) {
+        const auto chunk_begin = std::chrono::steady_clock::now();
+        const size_t before = done_;
+        fill(std::min(period_frames, target - done_));
+        slowest_secs = std::max(slowest_secs, seconds_since(chunk_begin));
+        if (done_ == before) {
+            break;
+        }
+    }
+    if (break_) {
+        return;
+    }
+    const double secs = seconds_since(begin);
+    if (done_ < PREFILL_SPEED_MIN * sample_rate_ * secs) {
+        ldebug("Reader::prefill(): reading at %.1fx real time only, filling whole ringbuffer\n",
+            done_ / (sample_rate_ * secs));
+        work_cycle();
+        return;
+    }
+    // Cover stalls like the worst one seen, until the worker catches up
+    const size_t margin = sample_rate_ * slowest_secs * PREFILL_STALL_FACTOR + .5;
+    if (margin != 0) {
+        fill(margin);
+    }
+}
+
+void Reader::skip(size_t frames) {
+    // Ringbuffer is still empty at this point, use it as a scratch
+    jack_ringbuffer_data_t vec[2];
+    jack_ringbuffer_get_write_vector(buffer(), vec);
+    const size_t chunk = vec[0].len / frame_size_;
+    while (frames != 0) {
+        size_t count = std::min(frames, chunk);
+        if (read_frames(reinterpret_cast<Sample*>(vec[0].buf), count) != count) {
+            throw runtime_error{str(format("unexpected end of stream while skipping %1% frames")
+                % frames)};
+        }
+        frames -= count;
+    }
+}
+
+size_t Reader::read_frames(Sample* frames, size_t frame_count) {
+    if (frame_count == 0) {
+        return 0;
+    }
+    if (playlist_ != nullptr) {
+        return playlist_->read(frames, frame_count);
+    }
+    if (memory_ != nullptr) {
+        return read_memory(frames, frame_count);
+    }
+    if (stdin_) {
+        return read_stdin(frames, frame_count);
+    }
+    return sf_readf_float(sf_.get(), frames, frame_count);
+}
+
+size_t Reader::read_stdin(Sample* frames, size_t frame_count) {
+#ifndef _WIN32
+    // Like sf_readf_float(), returns less than requested only at the end of stream,
+    // or once a stop was requested while the producer stalled.
+    auto dst = reinterpret_cast<char*>(frames);
+    const size_t wanted = frame_count * frame_size_;
+    size_t got = 0;
+    while (got != wanted && !stdin_eof_) {
+        pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+        const int ready = poll(&pfd, 1, STDIN_POLL_MS);
+        if (ready < 0 && errno != EINTR) {
+            throw runtime_error{str(format("failed waiting for stdin: %1%") % std::strerror(errno))};
+        }
+        if (ready <= 0) {
+            if (break_) {
+                break;
+            }
+            continue;
+        }
+        const ssize_t n = ::read(STDIN_FILENO, dst + got, wanted - got);
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN) {
+                continue;
+            }
+            throw runtime_error{str(format("failed reading stdin: %1%") % std::strerror(errno))};
+        }
+        if (n == 0) {
+            stdin_eof_ = true;
+        }
+        got += n;
+    }
+    // A partial frame at the end of stream is dropped, as libsndfile does
+    return got / frame_size_;
+#else
+    return 0;
+#endif
+}
+
+void Reader::load_loop(sf_count_t start_frame, sf_count_t frames_avail, const LoopRegion& loop) {
+    sf_count_t loop_start = loop.start_secs ? *loop.start_secs * sample_rate_ + .5 : start_frame;
+    sf_count_t loop_end = loop.end_secs ? *loop.end_secs * sample_rate_ + .5 : frames_avail;
+    loop_end = std::min(loop_end, frames_avail);
+    if (loop_start >= loop_end) {
+        throw runtime_error{str(format("loop region from frame %1% to %2% is empty")
+            % loop_start % loop_end)};
+    }
+    if (start_frame >= loop_end) {
+        throw runtime_error{str(format("playback start at frame %1% is past loop end at frame %2%")
+            % start_frame % loop_end)};
+    }
+    const size_t loop_frames = loop_end - loop_start;
+    crossfade_frames_ = loop.crossfade_secs * sample_rate_ + .5;
+    if (crossfade_frames_ * 2 > loop_frames) {
+        throw runtime_error{str(format("loop crossfade of %1% frames is longer than half of loop region of %2% frames")
+            % crossfade_frames_ % loop_frames)};
+    }
+
+    // Everything played at least once is kept in memory, the file isn't touched afterwards
+    const sf_count_t memory_start = std::min(start_frame, loop_start);
+    memory_frames_ = loop_end - memory_start;
+    if (mapped_) {
+        memory_ = mapped_->data() + memory_start * channel_count_;
+    } else {
+        decoded_.resize(memory_frames_ * channel_count_);
+        if (sf_seek(sf_.get(), memory_start, SEEK_SET) < 0) {
+            throw runtime_error{str(format("failed seeking input file to frame %1%")
+                % memory_start)};
+        }
+        size_t read = sf_readf_float(sf_.get(), decoded_.data(), memory_frames_);
+        if (read != memory_frames_) {
+            throw runtime_error{str(format("unexpected read of %1% frames when requested %2% for loop, premature EOF?")
+                % read % memory_frames_)};
+        }
+        sf_.reset();
+        memory_ = decoded_.data();
+    }
+    memory_pos_ = start_frame - memory_start;
+    loop_begin_ = loop_start - memory_start;
+
+    if (crossfade_frames_ != 0) {
+        crossfade_.resize(crossfade_frames_ * channel_count_);
+        const Sample* tail = memory_ + (memory_frames_ - crossfade_frames_) * channel_count_;
+        const Sample* head = memory_ + loop_begin_ * channel_count_;
+        for (size_t n = 0; n != crossfade_frames_; ++n) {
+            const double phase = HALF_PI * (n + .5) / crossfade_frames_;
+            const Sample fade_out = std::cos(phase);
+            const Sample fade_in = std::sin(phase);
+            for (size_t c = 0; c != channel_count_; ++c) {
+                const size_t i = n * channel_count_ + c;
+                crossfade_[i] = tail[i] * fade_out + head[i] * fade_in;
+            }
+        }
+    }
+
+    passes_left_ = loop.count;
+    // Passes after the first one resume right after the crossfaded head
+    needed_ = passes_left_ == 0
+        ? 0
+        : memory_frames_ - memory_pos_ + (passes_left_ - 1) * (loop_frames - crossfade_frames_);
+    ldebug("Reader::load_loop(): %zd frames in memory, looping frames %zd-%zd %s, crossfade %zd frames\n",
+        memory_frames_, (size_t)loop_start, (size_t)loop_end,
+        passes_left_ == 0 ? "forever" : str(format("%1% times") % passes_left_).c_str(),
+        crossfade_frames_);
+}
+
+size_t Reader::read_memory(Sample* frames, size_t frame_count) {
+    size_t read = 0;
+    while (read != frame_count) {
+        const bool last_pass = passes_left_ == 1;
+        if (memory_pos_ == memory_frames_) {
+            if (last_pass) {
+                break;
+            }
+            // Wrap around sample-accurately, the head was already played within the crossfade
+            memory_pos_ = loop_begin_ + crossfade_frames_;
+            if (passes_left_ != 0) {
+                --passes_left_;
+            }
+            continue;
+        }
+        const size_t tail_begin = last_pass ? memory_frames_ : memory_frames_ - crossfade_frames_;
+        const Sample* src;
+        size_t avail;
+        if (memory_pos_ < tail_begin) {
+            src = memory_ + memory_pos_ * channel_count_;
+            avail = tail_begin - memory_pos_;
+        } else {
+            src = &crossfade_[(memory_pos_ - tail_begin) * channel_count_];
+            avail = memory_frames_ - memory_pos_;
+        }
+        const size_t count = std::min(avail, frame_count - read);
+        std::memcpy(frames + read * channel_count_, src, count * frame_size_);
+        read += count;
+        memory_pos_ += count;
+    }
+    return read;
+}
+
+void Reader::convolve_cycle(size_t frame_count_max) {
+    const size_t block_frames = convolver_->block_frames();
+    // Whole blocks only, so the limit may be exceeded by less than a block
+    for (size_t written = 0; written < frame_count_max
+            && jack_ringbuffer_write_space(buffer()) / frame_size_ >= block_frames; ) {
+        size_t wanted = block_frames;
+        if (0 != needed_) {
+            assert(done_ <= needed_);
+            wanted = std::min(needed_ - done_, wanted);
+        }
+        const size_t read = read_frames(block_.data(), wanted);
+        if (read != wanted && 0 != needed_ && !break_) {
+            throw runtime_error{str(format("unexpected read of %1% frames when requested %2%, premature EOF?")
+                % read % wanted)};
+        }
+        if (read != 0) {
+            // Last block is padded with silence, filter tail past the end of playback is cut
+            std::fill(block_.begin() + read * channel_count_, block_.end(), 0.f);
+            convolver_->process(block_.data());
+            jack_ringbuffer_write(buffer(), reinterpret_cast<const char*>(block_.data()), read * frame_size_);
+            done_ += read;
+            written += read;
+        }
+        if (0 != needed_ && done_ == needed_) {
+            ldebug("Reader::convolve_cycle(): requesting worker stop, we're done after %zd frames\n", done_);
+            break_ = true;
+            return;
+        } else if (read != block_frames) {
+            ldebug("Reader::convolve_cycle(): requesting worker stop, end of stream after %zd frames\n", done_);
+            break_ = true;
+            return;
+        }
+    }
+}
+
 void Reader::work_cycle() {
-    size_t writable = jack_ringbuffer_write_space(buffer()) / frame_size_;
-    // Don't read past `needed_` frames
-    assert(done_ <= needed_);
-    // Limit the size because jack_rigbuffer_create may allocate buffer larger
-    // than buffer_size_ (rounding upwards to powers of 2) and reports the real
-    // allocated space here, leading to buffer overflow of buff_
-    writable = std::min(writable, buffer_size_);
-    writable = std::min(needed_ - done_, writable);
-    auto read = sf_readf_float(sf_.get(), buff_.get(), writable);
-    if (read != writable) {
+    fill(std::numeric_limits<size_t>::max());
+}
+
+void Reader::fill(size_t frame_count_max) {
+    if (convolver_) {
+        convolve_cycle(frame_count_max);
+        return;
+    }
+    jack_ringbuffer_data_t vec[2];
+    jack_ringbuffer_get_write_vector(buffer(), vec);
+    size_t writable = std::min((vec[0].len + vec[1].len) / frame_size_, frame_count_max);
+    if (0 != needed_) {
+        // Don't read past `needed_` frames
+        assert(done_ <= needed_);
+        writable = std::min(needed_ - done_, writable);
+    }
+    // Decode straight into ringbuffer memory, part before the wrap point first
+    const size_t head = std::min(writable, vec[0].len / frame_size_);
+    size_t read = read_frames(reinterpret_cast<Sample*>(vec[0].buf), head);
+    if (read == head && read != writable) {
+        // Frame straddling the wrap point (if any) goes through frame_
+        const size_t split = vec[0].len - head * frame_size_;
+        if (split != 0 && read_frames(frame_.get(), 1) == 1) {
+            auto frame = reinterpret_cast<const char*>(frame_.get());
+            std::memcpy(vec[0].buf + head * frame_size_, frame, split);
+            std::memcpy(vec[1].buf, frame + split, frame_size_ - split);
+            ++read;
+        }
+        if (split == 0 || read != head) {
+            auto tail = reinterpret_cast<Sample*>(vec[1].buf + (split != 0 ? frame_size_ - split : 0));
+            read += read_frames(tail, writable - read);
+        }
+    }
+    if (read != writable && 0 != needed_ && !break_) {
         throw runtime_error{str(format("unexpected read of %1% frames when requested %2%, premature EOF?")
             % read % writable)};
     }
-    size_t written = jack_ringbuffer_write(buffer(), reinterpret_cast<const char*>(buff_.get()), read * frame_size_);
-    assert(written == read * frame_size_);  // As we are the only producer
+    jack_ringbuffer_write_advance(buffer(), read * frame_size_);
     done_ += read;
-    if (done_ == needed_) {
+    if (0 != needed_ && done_ == needed_) {
         ldebug("Reader::refill(): requesting worker stop, we're done after %zd frames\n", done_);
         break_ = true;
+    } else if (read != writable) {
+        ldebug("Reader::refill(): requesting worker stop, end of stream after %zd frames\n", done_);
+        break_ = true;
     }
 }
 
@@ -176,45 +597,295 @@ Writer::Writer(
     size_t sample_rate,
     size_t channel_count,
     size_t buffer_size,
-    double duration_secs
+    double duration_secs,
+    FileFormat format,
+    size_t encoder_threads,
+    const optional<TriggerSettings>& trigger,
+    const vector<size_t>& splits,
+    PreviewWriter* preview
 ):
-    IoWorker{sample_rate, channel_count, buffer_size}
+    IoWorker{sample_rate, channel_count, buffer_size},
+    path_{path},
+    format_{format},
+    encoder_threads_{encoder_threads},
+    preview_{preview},
+    gaps_{jack_ringbuffer_create(GAPS_MAX * sizeof(Gap)), &jack_ringbuffer_free},
+    silence_{new Sample[SILENCE_FRAMES * channel_count]()}
 {
-    SF_INFO si = {0};
-    si.channels = channel_count_;
-    si.samplerate = sample_rate_;
-    si.format = SF_FORMAT_WAV | SF_FORMAT_PCM_32;
-    sf_ = open_sndfile(path, SFM_WRITE, si);
-    ldebug("Writer: writing to %s with %zd sample rate and %zd channels\n",
-        path.c_str(), sample_rate_, channel_count_);
+    if (!gaps_) {
+        throw runtime_error{"writer unable to allocate gap buffer"};
+    }
+    if (trigger) {
+        if (STDIO_PATH == path) {
+            throw runtime_error{"triggered recording can't be written to stdout"};
+        }
+        trigger_.reset(new LevelTrigger{channel_count_, trigger->channels, trigger->level_dbfs});
+        pre_frames_ = trigger->pre_secs * sample_rate_ + .5;
+        pre_trigger_.resize(pre_frames_ * channel_count_);
+        hold_frames_ = std::max<size_t>(trigger->hold_secs * sample_rate_ + .5, 1);
+        ldebug("Writer: recording events above %.1f dBFS into %s, %zd frames pre-trigger, %zd frames hold\n",
+            trigger->level_dbfs, path.c_str(), pre_frames_, hold_frames_);
+    } else if (!splits.empty()) {
+        if (STDIO_PATH == path) {
+            throw runtime_error{"split recording can't be written to stdout"};
+        }
+        splits_ = splits;
+        // Frames before the first split go into the first file too
+        open_output(numbered_path(path_, ++events_));
+        next_split_ = splits_[0] == 0 ? 1 : 0;
+    } else {
+        open_output(path_);
+    }
     needed_ = duration_secs * sample_rate_ + .5;
     thread_.reset(new std::thread(&Writer::pump, this));
 }
 
+void Writer::open_output(const string& path) {
+    SF_INFO si = {0};
+    const bool stdio = STDIO_PATH == path;
+    if (format_ == FileFormat::FLAC) {
+        if (stdio) {
+            throw runtime_error{"FLAC recording can't be written to stdout"};
+        }
+        encoder_.reset(new ParallelEncoder{path, sample_rate_, channel_count_, buffer_size_, encoder_threads_});
+    } else if (stdio) {
+        init_stdio_info(si, sample_rate_, channel_count_);
+        sf_ = open_sndfile(path, SFM_WRITE, si);
+    } else {
+        si.channels = channel_count_;
+        si.samplerate = sample_rate_;
+        si.format = SF_FORMAT_WAV | SF_FORMAT_PCM_32;
+        sf_ = open_sndfile(path, SFM_WRITE, si);
+    }
+    output_frames_ = 0;
+    ldebug("Writer: writing to %s with %zd sample rate and %zd channels\n",
+        stdio ? "stdout" : path.c_str(), sample_rate_, channel_count_);
+}
+
+void Writer::close_output() {
+    if (encoder_) {
+        encoder_->close();
+        ldebug("Writer::close_output(): encoded %zd bytes into %zd files, %.2f of PCM_32 size\n",
+            encoder_->bytes_written(), encoder_->file_count(),
+            encoder_->bytes_written() / (double)std::max<size_t>(output_frames_ * frame_size_, 1));
+        encoder_.reset();
+    }
+    sf_.reset();
+}
+
+void Writer::encode_frames(const Sample* frames, size_t frame_count) {
+    if (frame_count == 0) {
+        return;
+    }
+    size_t written = frame_count;
+    if (encoder_) {
+        encoder_->write(frames, frame_count);
+    } else {
+        written = sf_writef_float(sf_.get(), frames, frame_count);
+    }
+    if (written != frame_count) {
+        throw runtime_error{str(format("unexpected write of %1% frames when requested %2%, no more space?")
+            % written % frame_count)};
+    }
+    output_frames_ += frame_count;
+}
+
+void Writer::write_frames(const Sample* frames, size_t frame_count) {
+    if (preview_) {
+        preview_->push(frames, frame_count);
+    }
+    if (!splits_.empty()) {
+        write_split(frames, frame_count);
+        return;
+    }
+    if (!trigger_) {
+        encode_frames(frames, frame_count);
+        return;
+    }
+    while (frame_count != 0) {
+        if (!triggered_) {
+            const size_t first = trigger_->find_first(frames, frame_count);
+            keep_pre_trigger(frames, first);
+            if (first == frame_count) {
+                return;
+            }
+            start_event();
+            frames += first * channel_count_;
+            frame_count -= first;
+        }
+        // Record until channels stay quiet for hold_frames_
+        size_t n = 0;
+        while (n != frame_count && quiet_frames_ != hold_frames_) {
+            const size_t span = std::min(hold_frames_ - quiet_frames_, frame_count - n);
+            const size_t last = trigger_->find_last(frames + n * channel_count_, span);
+            quiet_frames_ = last != span ? span - 1 - last : quiet_frames_ + span;
+            n += span;
+        }
+        encode_frames(frames, n);
+        if (quiet_frames_ == hold_frames_) {
+            end_event();
+        }
+        frames += n * channel_count_;
+        frame_count -= n;
+    }
+}
+
+void Writer::write_split(const Sample* frames, size_t frame_count) {
+    while (frame_count != 0) {
+        if (next_split_ != splits_.size() && position_ == splits_[next_split_]) {
+            ++next_split_;
+            close_output();
+            open_output(numbered_path(path_, ++events_));
+        }
+        size_t count = frame_count;
+        if (next_split_ != splits_.size()) {
+            count = std::min(count, splits_[next_split_] - position_);
+        }
+        encode_frames(frames, count);
+        position_ += count;
+        frames += count * channel_count_;
+        frame_count -= count;
+    }
+}
+
+void Writer::keep_pre_trigger(const Sample* frames, size_t frame_count) {
+    if (pre_frames_ == 0) {
+        return;
+    }
+    if (frame_count > pre_frames_) {
+        frames += (frame_count - pre_frames_) * channel_count_;
+        frame_count = pre_frames_;
+    }
+    while (frame_count != 0) {
+        const size_t count = std::min(frame_count, pre_frames_ - pre_pos_);
+        std::memcpy(&pre_trigger_[pre_pos_ * channel_count_], frames, count * frame_size_);
+        pre_pos_ = (pre_pos_ + count) % pre_frames_;
+        pre_fill_ = std::min(pre_fill_ + count, pre_frames_);
+        frames += count * channel_count_;
+        frame_count -= count;
+    }
+}
+
+void Writer::start_event() {
+    ++events_;
+    const auto path = numbered_path(path_, events_);
+    linfo("Trigger event %zd at frame %zd, recording into %s\n", events_, done_, path.c_str());
+    open_output(path);
+    // Oldest pre-trigger frames first
+    const size_t oldest = (pre_pos_ + pre_frames_ - pre_fill_) % std::max<size_t>(pre_frames_, 1);
+    const size_t head = std::min(pre_fill_, pre_frames_ - oldest);
+    encode_frames(pre_trigger_.data() + oldest * channel_count_, head);
+    encode_frames(pre_trigger_.data(), pre_fill_ - head);
+    pre_fill_ = 0;
+    pre_pos_ = 0;
+    quiet_frames_ = 0;
+    triggered_ = true;
+}
+
+void Writer::end_event() {
+    ldebug("Writer::end_event(): event %zd done after %zd frames\n", events_, output_frames_);
+    recorded_ += output_frames_;
+    close_output();
+    triggered_ = false;
+}
+
+bool Writer::post_gap(size_t position, size_t frame_count) {
+    if (jack_ringbuffer_write_space(gaps_.get()) < sizeof(Gap)) {
+        return false;
+    }
+    const Gap gap = {position, frame_count};
+    jack_ringbuffer_write(gaps_.get(), reinterpret_cast<const char*>(&gap), sizeof(gap));
+    return true;
+}
+
+void Writer::write_silence(size_t frame_count) {
+    while (frame_count != 0) {
+        const size_t count = std::min(frame_count, SILENCE_FRAMES);
+        write_frames(silence_.get(), count);
+        frame_count -= count;
+    }
+}
+
+void Writer::fill_gaps() {
+    while (!done()) {
+        if (!gap_pending_) {
+            if (jack_ringbuffer_read(gaps_.get(), reinterpret_cast<char*>(&next_gap_), sizeof(Gap)) != sizeof(Gap)) {
+                return;
+            }
+            gap_pending_ = true;
+        }
+        if (next_gap_.position != consumed_) {
+            return;
+        }
+        size_t count = next_gap_.frame_count;
+        if (0 != needed_) {
+            count = std::min(count, needed_ - done_);
+        }
+        write_silence(count);
+        done_ += count;
+        gap_pending_ = false;
+        ldebug("Writer::fill_gaps(): filled %zd dropped frames with silence\n", count);
+    }
+}
+
 void Writer::work_cycle() {
-    size_t readable = jack_ringbuffer_read_space(buffer()) / frame_size_;
-    // Limit the size because jack_rigbuffer_create may allocate buffer larger
-    // than buffer_size_ (rounding upwards to powers of 2) and reports the real
-    // allocated space here, leading to buffer overflow of buff_
-    readable = std::min(readable, buffer_size_);
+    // Gaps go in before the frames which were captured after them
+    fill_gaps();
+    jack_ringbuffer_data_t vec[2];
+    jack_ringbuffer_get_read_vector(buffer(), vec);
+    size_t readable = (vec[0].len + vec[1].len) / frame_size_;
     if (0 != needed_) {
         assert(done_ <= needed_);
         readable = std::min(readable, needed_ - done_);
     }
-    size_t read = jack_ringbuffer_read(buffer(), reinterpret_cast<char*>(buff_.get()), readable * frame_size_);
-    assert(read == readable * frame_size_);  // As we are the only consumer
-    auto written = sf_writef_float(sf_.get(), buff_.get(), readable);
-    if (written != readable) {
-        throw runtime_error{str(format("unexpected write of %1% frames when requested %2%, no more space?")
-            % written % readable)};
+    if (gap_pending_) {
+        readable = std::min(readable, next_gap_.position - consumed_);
+    }
+    // Encode straight from ringbuffer memory, part before the wrap point first
+    const size_t head = std::min(readable, vec[0].len / frame_size_);
+    write_frames(reinterpret_cast<const Sample*>(vec[0].buf), head);
+    if (head != readable) {
+        // Frame straddling the wrap point (if any) is gathered in frame_
+        const size_t split = vec[0].len - head * frame_size_;
+        size_t straddling = 0;
+        if (split != 0) {
+            auto frame = reinterpret_cast<char*>(frame_.get());
+            std::memcpy(frame, vec[0].buf + head * frame_size_, split);
+            std::memcpy(frame + split, vec[1].buf, frame_size_ - split);
+            write_frames(frame_.get(), 1);
+            straddling = 1;
+        }
+        auto tail = reinterpret_cast<const Sample*>(vec[1].buf + (split != 0 ? frame_size_ - split : 0));
+        write_frames(tail, readable - head - straddling);
     }
-    done_ += written;
+    jack_ringbuffer_read_advance(buffer(), readable * frame_size_);
+    done_ += readable;
+    consumed_ += readable;
+    fill_gaps();
     if (0 != needed_ && done_ == needed_) {
         ldebug("Writer::drain(): requesting worker stop, we're done after %zd frames\n", done_);
         break_ = true;
     }
 }
 
+void Writer::flush() {
+    // Write out whatever is left in the ringbuffer after the Reactor is done
+    while (!done() && jack_ringbuffer_read_space(buffer()) >= frame_size_) {
+        work_cycle();
+    }
+    // Frames dropped at the very end
+    fill_gaps();
+    if (triggered_) {
+        end_event();
+    } else if (!trigger_) {
+        close_output();
+    }
+}
+
+Writer::~Writer() {
+    stop();
+}
+
 size_t query_audio_file_channels(const string& path) {
     SF_INFO si = {0};
     auto sf = open_sndfile(path, SFM_READ, si);
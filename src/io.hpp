@@ -1,5 +1,6 @@
 #pragma once
 #include "types.hpp"
+#include "trigger.hpp"
 
 #include <sndfile.h>
 #include <jack/ringbuffer.h>
@@ -10,6 +11,41 @@
 
 namespace olo {
 
+class ParallelEncoder;
+class StimulusCache;
+class MappedStimulus;
+class Convolver;
+class Playlist;
+class PreviewWriter;
+
+enum class FileFormat {
+    WAV,
+    FLAC
+};
+
+// Region of playback file played repeatedly from memory.
+struct LoopRegion {
+    // Number of passes through the region, 0 means infinite
+    size_t count = 1;
+    // Defaults to start offset of playback
+    optional<double> start_secs;
+    // Defaults to end of file
+    optional<double> end_secs;
+    // Length of equal-power crossfade of the region's tail into its head
+    double crossfade_secs = 0.;
+};
+
+using SndfilePtr = std::unique_ptr<SNDFILE, decltype(&sf_close)>;
+
+// Fills in format of raw interleaved float samples streamed through stdin/stdout.
+void init_stdio_info(SF_INFO& si, size_t sample_rate, size_t channel_count);
+// Opens an audio file, "-" stands for stdin or stdout depending on `mode`.
+SndfilePtr open_sndfile(const string& path, int mode, SF_INFO& si);
+// Replaces extension of the file name in `path`, if any, with `suffix`, e.g. ".json".
+string replace_extension(const string& path, const string& suffix);
+// Numbers a file path before its extension, e.g. foo.wav becomes foo-0001.wav.
+string numbered_path(const string& path, size_t number);
+
 // Shared properties and bits of implementation of Reader & Writer.
 class IoWorker {
 protected:
@@ -19,7 +55,9 @@ protected:
     // Ringbuffer size in frames.
     size_t buffer_size_;
     std::unique_ptr<jack_ringbuffer_t, decltype(&jack_ringbuffer_free)> ring_;
-    std::unique_ptr<Sample[]> buff_;
+    // Scratch space for a single frame straddling the ringbuffer wrap point,
+    // all other frames are decoded into/encoded from ringbuffer memory directly.
+    std::unique_ptr<Sample[]> frame_;
     std::unique_ptr<std::thread> thread_;
     std::mutex mx_;
     std::condition_variable cv_;
@@ -29,22 +67,31 @@ protected:
     // Stores number of frames read/written so far.
     size_t done_ = 0;
     volatile bool break_ = false;
+    // Run the first work cycle as soon as the worker starts instead of waiting to be woken
+    bool eager_start_ = false;
     // Stores exception thrown in worker thread for rethrow in join()
     std::exception_ptr ex_;
 
     explicit IoWorker(size_t sample_rate, size_t channel_count, size_t buffer_size);
     virtual void work_cycle() = 0;
+    // Called in worker thread after it has been stopped.
+    virtual void flush() {}
     void pump();
 
 public:
-    // We're joining thread in the destructor, which may throw
+    // We're joining thread in the destructor, which may throw. By then subclass members are
+    // gone, so subclasses owning state used by work_cycle()/flush() must call stop() in their
+    // destructor.
     virtual ~IoWorker() noexcept(false);
 
     jack_ringbuffer_t* buffer() const { return ring_.get(); }
+    // Worker thread, null if it's not running.
+    std::thread* thread() const { return thread_.get(); }
     size_t frame_size() const { return frame_size_; }
     size_t channel_count() const { return channel_count_; }
     size_t buffer_size() const { return buffer_size_; }
     size_t sample_rate() const { return sample_rate_; }
+    // Zero means unlimited: Writer records until stopped, Reader plays until end of stream.
     size_t frames_needed() const { return needed_; }
     size_t frames_done() const { return done_; }
 
@@ -55,31 +102,161 @@ public:
 };
 
 class Reader: public IoWorker {
+    // Decoded playback file, if it's read from StimulusCache
+    std::unique_ptr<MappedStimulus> mapped_;
+    // Decoded frames of looped file region, preceded by any frames played before the loop start
+    vector<Sample> decoded_;
+    // Frames read from memory instead of the file, either mapped_ or decoded_
+    const Sample* memory_ = nullptr;
+    size_t memory_frames_ = 0;
+    // Frame in memory_ to read next
+    size_t memory_pos_ = 0;
+    // Frame in memory_ where the loop region starts
+    size_t loop_begin_ = 0;
+    // Last crossfade_frames_ of the region blended with its first ones, used in place
+    // of the region's tail by all passes except the last one.
+    vector<Sample> crossfade_;
+    size_t crossfade_frames_ = 0;
+    // Passes through the loop region left including the current one, 0 means infinite
+    size_t passes_left_ = 0;
+    // Raw frames are read from stdin directly, so that a stalled producer can't hold up stop()
+    bool stdin_ = false;
+    bool stdin_eof_ = false;
+    // Stream of playlist items read instead of a single file, if set
+    Playlist* playlist_ = nullptr;
+    // Filters playback in blocks staged in block_, if set
+    Convolver* convolver_ = nullptr;
+    vector<Sample> block_;
+    // Frames put into ringbuffer before the worker was started, and time it took
+    size_t prefill_frames_ = 0;
+    double prefill_secs_ = 0.;
+
     void work_cycle() override;
+    void fill(size_t frame_count_max);
+    void convolve_cycle(size_t frame_count_max);
+    void prefill(size_t period_frames);
+    void check_convolver();
+    void start(size_t period_frames);
+    void skip(size_t frames);
+    size_t read_frames(Sample* frames, size_t frame_count);
+    size_t read_stdin(Sample* frames, size_t frame_count);
+    void load_loop(sf_count_t start_frame, sf_count_t frames_avail, const LoopRegion& loop);
+    size_t read_memory(Sample* frames, size_t frame_count);
 
 public:
+    // With `period_frames` set, only enough frames to cover a few Jack periods are read
+    // upfront and the worker fills the rest of the ringbuffer in background. Otherwise
+    // the ringbuffer is filled whole before the constructor returns.
     explicit Reader(
         const string& path,
         size_t sample_rate,
         size_t channel_count,
         size_t buffer_size,
         double duration_secs = 0.,
-        double start_offset_secs = 0.
+        double start_offset_secs = 0.,
+        const optional<LoopRegion>& loop = boost::none,
+        StimulusCache* cache = nullptr,
+        Convolver* convolver = nullptr,
+        size_t period_frames = 0
+    );
+    // Plays items of `playlist` back to back, until its end or `duration_secs`.
+    explicit Reader(
+        Playlist& playlist,
+        size_t sample_rate,
+        size_t channel_count,
+        size_t buffer_size,
+        double duration_secs = 0.,
+        Convolver* convolver = nullptr,
+        size_t period_frames = 0
     );
+    ~Reader();
+
+    size_t prefill_frames() const { return prefill_frames_; }
+    double prefill_secs() const { return prefill_secs_; }
 };
 
 class Writer: public IoWorker {
+    // Frames dropped by RT thread, recorded as silence to keep recording aligned to Jack timeline
+    struct Gap {
+        // Number of frames put into ringbuffer before the gap
+        size_t position;
+        size_t frame_count;
+    };
+
+    string path_;
+    FileFormat format_;
+    size_t encoder_threads_;
+    // Used instead of sf_ for FLAC recording
+    std::unique_ptr<ParallelEncoder> encoder_;
+    // Frames written into current output file(s)
+    size_t output_frames_ = 0;
+    // Set in triggered recording mode, where each event goes into its own file
+    std::unique_ptr<LevelTrigger> trigger_;
+    bool triggered_ = false;
+    // Input preceding trigger, a ring of pre_frames_ frames holding the last pre_fill_ ones
+    vector<Sample> pre_trigger_;
+    size_t pre_frames_ = 0;
+    size_t pre_pos_ = 0;
+    size_t pre_fill_ = 0;
+    size_t hold_frames_ = 0;
+    // Frames since input was last above trigger level
+    size_t quiet_frames_ = 0;
+    size_t events_ = 0;
+    // Frames written into finished event files
+    size_t recorded_ = 0;
+    // Positions where recording is split into numbered files, in frames since start
+    vector<size_t> splits_;
+    size_t next_split_ = 0;
+    // Frames passed to write_frames() so far, including gaps
+    size_t position_ = 0;
+    // Gets a copy of everything recorded, if set
+    PreviewWriter* preview_ = nullptr;
+    std::unique_ptr<jack_ringbuffer_t, decltype(&jack_ringbuffer_free)> gaps_;
+    Gap next_gap_ = {0, 0};
+    bool gap_pending_ = false;
+    // Number of frames taken from ringbuffer so far, unlike done_ this doesn't count gaps
+    size_t consumed_ = 0;
+    std::unique_ptr<Sample[]> silence_;
+
     void work_cycle() override;
+    void flush() override;
+    void open_output(const string& path);
+    void close_output();
+    void encode_frames(const Sample* frames, size_t frame_count);
+    void write_frames(const Sample* frames, size_t frame_count);
+    void write_split(const Sample* frames, size_t frame_count);
+    void write_silence(size_t frame_count);
+    void keep_pre_trigger(const Sample* frames, size_t frame_count);
+    void start_event();
+    void end_event();
+    void fill_gaps();
     bool done() const { return needed_ != 0 && done_ == needed_; }
 
 public:
+    // With `splits`, recording goes into files numbered after `path`, a new one starting
+    // at each of these positions in frames since start.
     explicit Writer(
         const string& path,
         size_t sample_rate,
         size_t channel_count,
         size_t buffer_size,
-        double duration_secs = 0.
+        double duration_secs = 0.,
+        FileFormat format = FileFormat::WAV,
+        size_t encoder_threads = 1,
+        const optional<TriggerSettings>& trigger = boost::none,
+        const vector<size_t>& splits = {},
+        PreviewWriter* preview = nullptr
     );
+    ~Writer();
+
+    // Number of trigger events or split files recorded so far
+    size_t events() const { return events_; }
+    // Number of frames in event files, valid after stop()
+    size_t frames_recorded() const { return recorded_; }
+
+    // Called from RT thread: `frame_count` frames following the first `position` frames put
+    // into ringbuffer were dropped. Returns false if there's no room to remember the gap.
+    bool post_gap(size_t position, size_t frame_count);
 };
 
 size_t query_audio_file_channels(const string& path);
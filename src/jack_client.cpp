@@ -1,6 +1,8 @@
 #include "jack_client.hpp"
 #include "log.hpp"
 
+#include <jack/thread.h>
+
 #include <stdexcept>
 #include <cstdio>
 
@@ -21,9 +23,19 @@ JackClient::JackClient(const string& name):
     ldebug("JackClient: engine is using sample rate %zd\n", sample_rate_);
 }
 
-vector<string> JackClient::enumerate_ports(int type) const {
+optional<int> JackClient::realtime_priority() const {
+    if (!jack_is_realtime(handle())) {
+        return boost::none;
+    }
+    return jack_client_real_time_priority(handle());
+}
+
+vector<string> JackClient::enumerate_ports(int type, bool allow_empty) const {
     const char **ports = jack_get_ports(handle(), NULL, JACK_DEFAULT_AUDIO_TYPE, type);
     if (ports == nullptr) {
+        if (allow_empty) {
+            return {};
+        }
         throw std::runtime_error("enumerating Jack channels failed");
     }
     vector<string> res;
@@ -18,9 +18,13 @@ public:
     const char* name() const { return name_; }
     jack_client_t* handle() const { return client_.get(); }
     size_t sample_rate() const { return sample_rate_; }
+    // Priority of Jack's RT thread, unset if the server doesn't run real-time.
+    optional<int> realtime_priority() const;
 
     void dump_ports() const;
-    vector<string> enumerate_ports(int type) const;
+    // Jack reports no matching ports the same way as a failure, so with `allow_empty`
+    // that's taken as an empty list rather than thrown.
+    vector<string> enumerate_ports(int type, bool allow_empty = false) const;
     vector<string> capture_ports() const { return enumerate_ports(JackPortIsPhysical | JackPortIsOutput); }
     vector<string> playback_ports() const { return enumerate_ports(JackPortIsPhysical | JackPortIsInput); }
 };
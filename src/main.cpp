@@ -2,21 +2,37 @@
 #include "cli.hpp"
 #include "jack_client.hpp"
 #include "io.hpp"
+#include "cache.hpp"
+#include "encoder.hpp"
+#include "convolver.hpp"
+#include "playlist.hpp"
+#include "preview.hpp"
 #include "reactor.hpp"
+#include "session.hpp"
+#include "shm.hpp"
+#include "ram.hpp"
+#include "soak.hpp"
+#include "spectrum.hpp"
+#include "xrun.hpp"
+#include "rt.hpp"
 #include "log.hpp"
 
 #include <jack/jack.h>
 
 #include <memory>
 #include <exception>
+#include <stdexcept>
 #include <iostream>
 #include <iomanip>
+#include <thread>
+#include <numeric>
 
 namespace olo {
 using std::unique_ptr;
 
 namespace {
-void fixup_default_ports(Args& args, const JackClient& client) {
+// Playback ports default to as many as `playback_file` has channels.
+void fixup_default_ports(Args& args, const JackClient& client, const string& playback_file) {
     if(args.input_ports == Args::PORTS_DEFAULT) {
         args.input_ports = client.capture_ports();
         if (args.input_channel_count) {
@@ -25,12 +41,60 @@ void fixup_default_ports(Args& args, const JackClient& client) {
     }
     if(args.output_ports == Args::PORTS_DEFAULT) {
         args.output_ports = client.playback_ports();
-        if (!args.input_file.empty()) {
-            auto channels = query_audio_file_channels(args.input_file);
+        if (!playback_file.empty() && STDIO_PATH != playback_file) {
+            auto channels = query_audio_file_channels(playback_file);
             args.output_ports.resize(std::min(args.output_ports.size(), channels));
         }
     }
 }
+
+// Locks memory & schedules workers before the Reactor gets activated.
+void harden(
+    const Args& args,
+    const JackClient& client,
+    Reader* reader,
+    Convolver* convolver,
+    Writer* writer,
+    ShmPublisher* publisher,
+    SoakTest* soak,
+    SpectrumAnalyzer* analyzer
+) {
+    RtSetup rt{args.rt_policy == "rr" ? RtPolicy::RR : RtPolicy::FIFO};
+    rt.lock_memory();
+    // Stay below Jack's process thread, which must never wait for us
+    const int priority_default = std::max(1, client.realtime_priority().value_or(20) - 10);
+    if (reader) {
+        rt.lock_buffer(reader->buffer(), "playback");
+        if (reader->thread()) {
+            rt.schedule(*reader->thread(), {args.reader_priority.value_or(priority_default), args.reader_cpus}, "reader");
+        }
+    }
+    if (convolver) {
+        // Convolution threads keep pace with the reader they work for
+        for (auto& thread: convolver->pool().threads()) {
+            rt.schedule(thread, {args.reader_priority.value_or(priority_default), args.reader_cpus}, "convolver");
+        }
+    }
+    if (writer) {
+        rt.lock_buffer(writer->buffer(), "record");
+        if (writer->thread()) {
+            rt.schedule(*writer->thread(), {args.writer_priority.value_or(priority_default), args.writer_cpus}, "writer");
+        }
+    }
+    if (soak) {
+        // Verifier stands in for the writer
+        rt.lock_buffer(soak->buffer(), "soak test");
+        rt.schedule(*soak->thread(), {args.writer_priority.value_or(priority_default), args.writer_cpus}, "soak test");
+    }
+    if (analyzer) {
+        // Its threads stay at idle priority
+        rt.lock_buffer(analyzer->buffer(), "spectrum");
+    }
+    if (publisher) {
+        rt.lock_region(publisher->segment(), publisher->segment_size(), "shared memory");
+    }
+    rt.report();
+}
 }
 
 void main(int argc, char** argv) {
@@ -44,51 +108,341 @@ void main(int argc, char** argv) {
         return;
     }
 
-    fixup_default_ports(args, client);
+    // Soak test loops own ports back, unless told which ports are looped back outside
+    const bool soak_self = args.soak && args.input_ports == Args::PORTS_DEFAULT;
+    if (soak_self) {
+        args.input_ports = args.output_ports = vector<string>(args.soak_channels);
+    }
+    vector<string> playlist_paths;
+    if (!args.playlist_file.empty()) {
+        playlist_paths = Playlist::load(args.playlist_file);
+    }
+    fixup_default_ports(args, client, playlist_paths.empty() ? args.input_file : playlist_paths.front());
+    if (args.flac && !args.output_file.empty()) {
+        // Each FLAC file is a single stream, encoded by one thread
+        const size_t file_count = (args.input_ports.size() + ParallelEncoder::GROUP_CHANNELS_MAX - 1)
+            / ParallelEncoder::GROUP_CHANNELS_MAX;
+        if (args.encoder_threads > file_count) {
+            linfo("Recording goes into %zd FLAC files, using %zd encoder threads instead of %zd\n",
+                file_count, file_count, args.encoder_threads);
+        }
+    }
+
+    optional<LoopRegion> loop;
+    if (args.loop_count) {
+        loop = LoopRegion{*args.loop_count, args.loop_start_secs, args.loop_end_secs, args.loop_crossfade_secs};
+    }
+
+    unique_ptr<StimulusCache> cache;
+    if (args.cache) {
+        cache.reset(new StimulusCache {
+            args.cache_dir.empty() ? StimulusCache::default_dir() : args.cache_dir,
+            args.cache_size_mb * 1024 * 1024
+        });
+    }
+
+    unique_ptr<Convolver> convolver;
+    if (!args.fir_file.empty()) {
+        const size_t channel_count = args.output_ports.size();
+        // Partitions of a power of 2 frames, several of which fit the ring buffer
+        size_t block_frames = 64;
+        while (block_frames < 1024 && block_frames * 4 <= args.buffer_size) {
+            block_frames *= 2;
+        }
+        const size_t thread_count = args.fir_threads != 0
+            ? args.fir_threads
+            : std::min<size_t>(channel_count, std::max(1u, std::thread::hardware_concurrency()));
+        convolver.reset(new Convolver {
+            load_filters(args.fir_file, client.sample_rate(), channel_count),
+            block_frames,
+            thread_count
+        });
+    }
+
+    // Ports are registered on a background thread, while playback is prefilled and the rest is set up.
+    // There's only one session per process, so nothing to reuse its ports for; they're left for the
+    // client to drop on exit instead of being unregistered one by one.
+    SessionManager sessions{client, false, true};
+    const bool capturing = !args.output_file.empty() || !args.shm_name.empty() || !args.spectrum_file.empty() || args.soak;
+    const bool playing = !args.input_file.empty() || !playlist_paths.empty() || args.soak;
+    sessions.preregister_ports(
+        capturing ? args.input_ports : vector<string>{},
+        playing ? args.output_ports : vector<string>{}
+    );
 
+    // Time to first sample is measured from here to the first cycle playing the reader's frames
+    const jack_time_t setup_time = jack_get_time();
+    unique_ptr<Playlist> playlist;
+    if (!playlist_paths.empty()) {
+        // Next item's start is decoded ahead, a ring buffer full of it
+        playlist.reset(new Playlist {
+            playlist_paths,
+            client.sample_rate(),
+            args.output_ports.size(),
+            args.gap_secs,
+            args.buffer_size
+        });
+    }
     unique_ptr<Reader> reader;
-    if (!args.input_file.empty()) {
+    if (playlist) {
+        reader.reset(new Reader {
+            *playlist,
+            client.sample_rate(),
+            args.output_ports.size(),
+            args.buffer_size,
+            args.duration_secs.value_or(0),
+            convolver.get(),
+            jack_get_buffer_size(client.handle())
+        });
+    } else if (!args.input_file.empty()) {
         reader.reset(new Reader {
             args.input_file,
             client.sample_rate(),
             args.output_ports.size(),
             args.buffer_size,
             args.duration_secs.value_or(0),
-            args.start_offset_secs
+            args.start_offset_secs,
+            loop,
+            cache.get(),
+            convolver.get(),
+            jack_get_buffer_size(client.handle())
+        });
+    }
+
+    optional<TriggerSettings> trigger;
+    if (args.trigger_dbfs) {
+        trigger = TriggerSettings{*args.trigger_dbfs, args.trigger_channels, args.pre_trigger_secs, args.hold_secs};
+    }
+
+    unique_ptr<RamRecorder> ram;
+    if (args.ram) {
+        // Length of the take is either given or that of playback
+        ram.reset(new RamRecorder {
+            args.output_file,
+            client.sample_rate(),
+            args.input_ports.size(),
+            args.duration_secs
+                ? static_cast<size_t>(*args.duration_secs * client.sample_rate() + .5)
+                : reader ? reader->frames_needed() : 0,
+            args.flac ? FileFormat::FLAC : FileFormat::WAV,
+            args.encoder_threads != 0 ? args.encoder_threads : std::max(1u, std::thread::hardware_concurrency())
         });
     }
 
+    // Recording starts together with playback, so items start at the same frames in both
+    vector<size_t> splits;
+    if (args.split) {
+        for (auto& item: playlist->items()) {
+            splits.push_back(item.frame);
+        }
+    }
+    unique_ptr<PreviewWriter> preview;
+    if (!args.preview_file.empty()) {
+        auto mix = args.preview_mix;
+        if (mix.empty()) {
+            mix.emplace_back(args.input_ports.size());
+            std::iota(mix.back().begin(), mix.back().end(), 0);
+        }
+        // Room for twice what the writer takes from its ringbuffer at once
+        preview.reset(new PreviewWriter {
+            args.preview_file,
+            client.sample_rate(),
+            args.input_ports.size(),
+            2 * args.buffer_size,
+            mix,
+            args.preview_rate
+        });
+    }
     unique_ptr<Writer> writer;
-    if (!args.output_file.empty()) {
+    if (!args.output_file.empty() && !ram) {
         writer.reset(new Writer {
             args.output_file,
             client.sample_rate(),
             args.input_ports.size(),
             args.buffer_size,
+            args.duration_secs.value_or(0),
+            args.flac ? FileFormat::FLAC : FileFormat::WAV,
+            args.encoder_threads != 0 ? args.encoder_threads : std::max(1u, std::thread::hardware_concurrency()),
+            trigger,
+            splits,
+            preview.get()
+        });
+    }
+
+    string index_file = args.index_file;
+    if (playlist && index_file.empty() && !args.output_file.empty() && STDIO_PATH != args.output_file) {
+        index_file = replace_extension(args.output_file, ".index.json");
+    }
+    if (!index_file.empty()) {
+        playlist->write_index(index_file, args.output_file, args.split);
+    }
+
+    unique_ptr<ShmPublisher> publisher;
+    if (!args.shm_name.empty()) {
+        publisher.reset(new ShmPublisher {
+            args.shm_name,
+            client.sample_rate(),
+            args.input_ports.size(),
+            args.shm_ring_secs,
+            args.duration_secs.value_or(0)
+        });
+    }
+
+    unique_ptr<SpectrumAnalyzer> analyzer;
+    if (!args.spectrum_file.empty()) {
+        analyzer.reset(new SpectrumAnalyzer {
+            args.spectrum_file,
+            client.sample_rate(),
+            args.input_ports.size(),
+            args.spectrum_size,
+            args.spectrum_rate,
+            args.spectrum_threads != 0
+                ? args.spectrum_threads
+                : std::min<size_t>(args.input_ports.size(), std::max(1u, std::thread::hardware_concurrency())),
             args.duration_secs.value_or(0)
         });
     }
 
+    unique_ptr<XrunLog> xrun_log;
+    if (!args.xrun_log.empty()) {
+        xrun_log.reset(new XrunLog{args.xrun_log, client.sample_rate(), args.preserve_timeline});
+    }
+
+    unique_ptr<SoakTest> soak;
+    if (args.soak) {
+        soak.reset(new SoakTest {
+            client.handle(),
+            client.sample_rate(),
+            args.output_ports.size(),
+            args.buffer_size,
+            args.duration_secs.value_or(0),
+            soak_self
+        });
+    }
+
+    if (args.rt) {
+        harden(args, client, reader.get(), convolver.get(), writer.get(), publisher.get(), soak.get(), analyzer.get());
+    }
+
     Reactor reactor {
-        client,
+        sessions,
         args.input_ports,
         args.output_ports,
         reader.get(),
         writer.get(),
-        args.duration_secs && 0 == *args.duration_secs
+        publisher.get(),
+        args.duration_secs && 0 == *args.duration_secs,
+        StartCondition{args.at_frame, args.on_transport},
+        args.preserve_timeline,
+        xrun_log.get(),
+        ram.get(),
+        soak.get(),
+        analyzer.get()
     };
 
     reactor.wait_finished();
+    if (ram) {
+        // Save while the rest is torn down
+        ram->save();
+    }
 
+    // Keep stdout clean if recording goes there
+    std::ostream& report = STDIO_PATH == args.output_file ? std::cerr : std::cout;
+    const auto& setup = reactor.setup();
+    report << "session setup: " << std::fixed << std::setprecision(1) << setup.total_secs * 1000. << " ms (validate "
+        << setup.validate_secs * 1000. << " ms, register " << setup.register_secs * 1000. << " ms, activate "
+        << setup.activate_secs * 1000. << " ms, connect " << setup.connect_secs * 1000. << " ms)\n";
+    report << "session ports: " << setup.ports_registered << " registered, " << setup.ports_preregistered
+        << " registered ahead, " << setup.ports_reused << " reused; connections: " << setup.connections_made
+        << " made, " << setup.connections_reused << " reused\n";
+    if (args.at_frame || args.on_transport) {
+        if (reactor.start_frame()) {
+            report << "started at frame: " << *reactor.start_frame() << "\n";
+        } else {
+            report << "start condition not met, nothing played or recorded\n";
+        }
+    }
     if (reader) {
         reader->stop();
-        std::cout << "frames read: " << reader->frames_done() << " ("
+        report << "frames read: " << reader->frames_done() << " ("
             << std::fixed << std::setprecision(3) << reader->frames_done() / (double)reader->sample_rate() << "s)\n";
+        if (reactor.first_sample_time()) {
+            report << "time to first sample: " << std::setprecision(1) << (*reactor.first_sample_time() - setup_time) / 1000.
+                << " ms (prefilled " << reader->prefill_frames() << " frames in " << reader->prefill_secs() * 1000. << " ms)\n";
+        }
     }
     if (writer) {
         writer->stop();
-        std::cout << "frames written: " << writer->frames_done() << " ("
+        report << "frames written: " << writer->frames_done() << " ("
             << std::fixed << std::setprecision(3) << writer->frames_done() / (double)writer->sample_rate() << "s)\n";
+        if (args.split) {
+            report << "record files: " << writer->events() << "\n";
+        }
+        if (preview) {
+            preview->stop();
+            report << "preview frames written: " << preview->frames_written() << " ("
+                << preview->preview_channels() << " channels at " << preview->preview_rate() << " Hz)";
+            if (preview->frames_skipped() != 0) {
+                report << ", " << preview->frames_skipped() << " recorded frames skipped";
+            }
+            report << "\n";
+        }
+        if (trigger) {
+            report << "trigger events: " << writer->events() << ", frames recorded: " << writer->frames_recorded() << " ("
+                << std::fixed << std::setprecision(3) << writer->frames_recorded() / (double)writer->sample_rate() << "s)\n";
+        }
+    }
+    if (ram) {
+        ram->join();
+        report << "frames written: " << ram->frames_done() << " ("
+            << std::fixed << std::setprecision(3) << ram->frames_done() / (double)ram->sample_rate() << "s)\n";
+        report << "sample rate: " << ram->sample_rate() << (ram->locked() ? "" : ", recording memory was not locked") << "\n";
+    }
+    if (analyzer) {
+        analyzer->stop();
+        report << "spectra written: " << analyzer->updates() << " (" << analyzer->path() << ")";
+        if (analyzer->frames_skipped() != 0) {
+            report << ", " << analyzer->frames_skipped() << " frames skipped";
+        }
+        report << "\n";
+    }
+    if (soak) {
+        soak->stop();
+        const auto& r = soak->report();
+        report << "soak test: " << soak->channel_count() << " channels, "
+            << jack_get_buffer_size(client.handle()) << " frames period, " << soak->sample_rate() << " Hz\n";
+        report << "frames verified: " << r.frames_verified << " ("
+            << std::fixed << std::setprecision(3) << r.frames_verified / (double)soak->sample_rate() << "s)\n";
+        report << "frames dropped: " << r.frames_dropped << "\n";
+        report << "frames duplicated: " << r.frames_duplicated << "\n";
+        report << "frames corrupt: " << r.frames_corrupt << "\n";
+        if (r.latency) {
+            report << "loopback latency: " << *r.latency << " frames, drift: " << r.latency_max - r.latency_min
+                << " frames (" << r.latency_min << " to " << r.latency_max << ")\n";
+        } else {
+            report << "loopback latency: signal never arrived\n";
+        }
+        report << "xruns: " << reactor.xruns() << ", overruns: " << reactor.overruns() << "\n";
+        report << "jack cpu load: mean " << std::setprecision(1) << r.load_mean << "%, max " << r.load_max << "%\n";
+    }
+    if (!index_file.empty()) {
+        report << "playlist items: " << playlist->items().size() << " (" << index_file << ")\n";
+    }
+    if (xrun_log) {
+        xrun_log->close();
+        report << "xruns logged: " << xrun_log->count() << " (" << xrun_log->path() << ")\n";
+    }
+    if (publisher) {
+        publisher->close();
+        report << "frames published: " << publisher->frames_done() << " ("
+            << std::fixed << std::setprecision(3) << publisher->frames_done() / (double)publisher->sample_rate() << "s)\n";
+    }
+    if (soak) {
+        const auto& r = soak->report();
+        if (!r.latency || r.frames_dropped || r.frames_duplicated || r.frames_corrupt
+                || r.latency_min != r.latency_max || reactor.xruns() || reactor.overruns()) {
+            throw std::runtime_error{"soak test failed"};
+        }
     }
 }
 }
@@ -0,0 +1,206 @@
+#include "playlist.hpp"
+#include "log.hpp"
+
+#include <boost/format.hpp>
+
+#include <stdexcept>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+
+namespace olo {
+using std::runtime_error;
+using boost::format;
+
+namespace {
+bool is_absolute(const string& path) {
+    return (!path.empty() && (path[0] == '/' || path[0] == '\\'))
+        || (path.size() > 1 && path[1] == ':');
+}
+
+string json_string(const string& s) {
+    string res = "\"";
+    for (char c: s) {
+        if (c == '"' || c == '\\') {
+            res += '\\';
+            res += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            res += str(format("\\u%04x") % static_cast<int>(c));
+        } else {
+            res += c;
+        }
+    }
+    return res + "\"";
+}
+}
+
+vector<string> Playlist::load(const string& path) {
+    std::ifstream f{path};
+    if (!f) {
+        throw runtime_error{str(format("can't open playlist: %1%") % path)};
+    }
+    const auto dir = path.find_last_of("/\\");
+    vector<string> paths;
+    string line;
+    while (std::getline(f, line)) {
+        const auto begin = line.find_first_not_of(" \t");
+        if (begin == string::npos || line[begin] == '#') {
+            continue;
+        }
+        line = line.substr(begin, line.find_last_not_of(" \t\r") + 1 - begin);
+        paths.push_back(is_absolute(line) || dir == string::npos ? line : path.substr(0, dir + 1) + line);
+    }
+    if (paths.empty()) {
+        throw runtime_error{str(format("playlist is empty: %1%") % path)};
+    }
+    return paths;
+}
+
+Playlist::Playlist(
+    const vector<string>& paths,
+    size_t sample_rate,
+    size_t channel_count,
+    double gap_secs,
+    size_t standby_frames
+):
+    sample_rate_{sample_rate},
+    channel_count_{channel_count},
+    gap_frames_{static_cast<size_t>(gap_secs * sample_rate + .5)},
+    standby_frames_{standby_frames}
+{
+    // Fail early on any bad item, not in the middle of a session
+    for (auto& path: paths) {
+        SF_INFO si = {0};
+        auto sf = open_sndfile(path, SFM_READ, si);
+        if (static_cast<size_t>(si.samplerate) != sample_rate_) {
+            throw runtime_error{str(format("playlist item %1% sample rate: %2%; engine sample rate: %3%")
+                % path % si.samplerate % sample_rate_)};
+        }
+        if (static_cast<size_t>(si.channels) != channel_count_) {
+            throw runtime_error{str(format("playlist item %1% channels: %2%; engine channels: %3%")
+                % path % si.channels % channel_count_)};
+        }
+        items_.push_back({path, frame_count_, static_cast<size_t>(si.frames)});
+        frame_count_ += si.frames + gap_frames_;
+    }
+    ldebug("Playlist: %zd items, %zd frames with %zd frames of silence after each\n",
+        items_.size(), frame_count_, gap_frames_);
+    if (!items_.empty()) {
+        prefetch(0);
+    }
+}
+
+Playlist::~Playlist() {
+    if (prefetch_) {
+        prefetch_->join();
+    }
+}
+
+void Playlist::prefetch(size_t index) {
+    prefetch_.reset(new std::thread([this, index] {
+        try {
+            auto& item = items_[index];
+            SF_INFO si = {0};
+            standby_.sf = open_sndfile(item.path, SFM_READ, si);
+            if (static_cast<size_t>(si.frames) != item.frame_count) {
+                throw runtime_error{str(format("playlist item %1% changed while playing, %2% frames instead of %3%")
+                    % item.path % si.frames % item.frame_count)};
+            }
+            const size_t count = std::min(standby_frames_, item.frame_count);
+            standby_.head.resize(count * channel_count_);
+            if (sf_readf_float(standby_.sf.get(), standby_.head.data(), count) != static_cast<sf_count_t>(count)) {
+                throw runtime_error{str(format("unexpected end of playlist item %1%") % item.path)};
+            }
+        } catch (...) {
+            standby_.ex = std::current_exception();
+        }
+    }));
+}
+
+void Playlist::activate() {
+    // Usually the standby is ready long before
+    prefetch_->join();
+    prefetch_.reset();
+    if (standby_.ex) {
+        std::exception_ptr ex;
+        std::swap(standby_.ex, ex);
+        std::rethrow_exception(ex);
+    }
+    sf_ = std::move(standby_.sf);
+    head_.swap(standby_.head);
+    pos_ = 0;
+    gap_pos_ = 0;
+    active_ = true;
+    ldebug("Playlist::activate(): item %zd of %zd at frame %zd, %s\n",
+        current_ + 1, items_.size(), items_[current_].frame, items_[current_].path.c_str());
+    if (current_ + 1 != items_.size()) {
+        prefetch(current_ + 1);
+    }
+}
+
+size_t Playlist::read(Sample* frames, size_t frame_count) {
+    size_t read = 0;
+    while (read != frame_count && current_ != items_.size()) {
+        if (!active_) {
+            activate();
+        }
+        Sample* dst = frames + read * channel_count_;
+        const size_t wanted = frame_count - read;
+        const auto& item = items_[current_];
+        const size_t head_frames = head_.size() / channel_count_;
+        if (pos_ < head_frames) {
+            const size_t count = std::min(wanted, head_frames - pos_);
+            std::memcpy(dst, &head_[pos_ * channel_count_], count * channel_count_ * sizeof(Sample));
+            pos_ += count;
+            read += count;
+        } else if (pos_ < item.frame_count) {
+            const size_t count = std::min(wanted, item.frame_count - pos_);
+            const sf_count_t n = sf_readf_float(sf_.get(), dst, count);
+            if (n <= 0) {
+                throw runtime_error{str(format("unexpected end of playlist item %1% after %2% frames")
+                    % item.path % pos_)};
+            }
+            pos_ += n;
+            read += n;
+        } else if (gap_pos_ < gap_frames_) {
+            const size_t count = std::min(wanted, gap_frames_ - gap_pos_);
+            std::fill(dst, dst + count * channel_count_, 0.f);
+            gap_pos_ += count;
+            read += count;
+        } else {
+            sf_.reset();
+            active_ = false;
+            ++current_;
+        }
+    }
+    return read;
+}
+
+void Playlist::write_index(const string& path, const string& record_path, bool split) const {
+    std::unique_ptr<FILE, decltype(&std::fclose)> f{std::fopen(path.c_str(), "w"), std::fclose};
+    if (!f) {
+        throw runtime_error{str(format("can't write playlist index: %1%") % path)};
+    }
+    std::fprintf(f.get(), "{\n  \"sample_rate\": %zu,\n  \"gap_frames\": %zu,\n  \"frames\": %zu,\n",
+        sample_rate_, gap_frames_, frame_count_);
+    if (!record_path.empty() && !split) {
+        std::fprintf(f.get(), "  \"record_file\": %s,\n", json_string(record_path).c_str());
+    }
+    std::fprintf(f.get(), "  \"items\": [");
+    for (size_t i = 0; i != items_.size(); ++i) {
+        auto& item = items_[i];
+        std::fprintf(f.get(), "%s\n    {\"file\": %s, \"frame\": %zu, \"time\": %.6f, \"frames\": %zu, \"duration\": %.6f",
+            i == 0 ? "" : ",", json_string(item.path).c_str(), item.frame, item.frame / (double)sample_rate_,
+            item.frame_count, item.frame_count / (double)sample_rate_);
+        if (!record_path.empty() && split) {
+            std::fprintf(f.get(), ", \"record_file\": %s", json_string(numbered_path(record_path, i + 1)).c_str());
+        }
+        std::fputc('}', f.get());
+    }
+    std::fprintf(f.get(), "\n  ]\n}\n");
+    if (std::fclose(f.release()) != 0) {
+        throw runtime_error{str(format("failed writing playlist index: %1%") % path)};
+    }
+}
+
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include "types.hpp"
+#include "io.hpp"
+
+#include <memory>
+#include <thread>
+#include <exception>
+
+namespace olo {
+
+// Playback files played back to back as one stream, each followed by a stretch of
+// silence. Lengths of all items are read upfront, so that their positions in the
+// stream are known before playback starts. While an item plays, the next one is
+// opened and its start decoded into a standby buffer on a thread of its own, and
+// the reader switches over to it without missing a frame.
+class Playlist {
+public:
+    struct Item {
+        string path;
+        // Position of the item's first frame in the stream
+        size_t frame;
+        size_t frame_count;
+    };
+
+private:
+    struct Standby {
+        SndfilePtr sf{nullptr, sf_close};
+        // First frames of the item, decoded ahead
+        vector<Sample> head;
+        std::exception_ptr ex;
+    };
+
+    size_t sample_rate_;
+    size_t channel_count_;
+    size_t gap_frames_;
+    size_t standby_frames_;
+    vector<Item> items_;
+    size_t frame_count_ = 0;
+    Standby standby_;
+    std::unique_ptr<std::thread> prefetch_;
+    // Item being read, items_.size() once all of them are done
+    size_t current_ = 0;
+    bool active_ = false;
+    SndfilePtr sf_{nullptr, sf_close};
+    vector<Sample> head_;
+    // Frames of current item read so far, and of the silence following it
+    size_t pos_ = 0;
+    size_t gap_pos_ = 0;
+
+    void prefetch(size_t index);
+    void activate();
+
+public:
+    // Reads playback file paths from a list file, one per line. Empty lines and lines
+    // starting with # are skipped (so M3U files work), relative paths are relative to the list.
+    static vector<string> load(const string& path);
+
+    // `standby_frames` of each item are decoded ahead, before the previous one ends.
+    explicit Playlist(
+        const vector<string>& paths,
+        size_t sample_rate,
+        size_t channel_count,
+        double gap_secs,
+        size_t standby_frames
+    );
+    ~Playlist();
+
+    Playlist(const Playlist&) = delete;
+    Playlist& operator=(const Playlist&) = delete;
+
+    const vector<Item>& items() const { return items_; }
+    size_t gap_frames() const { return gap_frames_; }
+    // Length of the whole stream, including silence after the last item
+    size_t frame_count() const { return frame_count_; }
+
+    // Called from Reader thread, returns less than `frame_count` frames only at the end.
+    size_t read(Sample* frames, size_t frame_count);
+    // Writes JSON index of items, with files they were recorded into if any.
+    void write_index(const string& path, const string& record_path, bool split) const;
+};
+
+}
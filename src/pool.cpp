@@ -0,0 +1,74 @@
+#include "pool.hpp"
+
+namespace olo {
+
+ThreadPool::ThreadPool(size_t thread_count) {
+    threads_.reserve(thread_count);
+    for (size_t i = 0; i != thread_count; ++i) {
+        threads_.emplace_back(&ThreadPool::work, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock{mx_};
+        break_ = true;
+    }
+    work_cv_.notify_all();
+    for (auto& thread: threads_) {
+        thread.join();
+    }
+}
+
+void ThreadPool::run_tasks(std::unique_lock<std::mutex>& lock) {
+    while (next_ != count_) {
+        const size_t i = next_++;
+        ++running_;
+        lock.unlock();
+        try {
+            (*task_)(i);
+        } catch (...) {
+            lock.lock();
+            if (!ex_) {
+                ex_ = std::current_exception();
+            }
+            lock.unlock();
+        }
+        lock.lock();
+        if (--running_ == 0 && next_ == count_) {
+            done_cv_.notify_all();
+        }
+    }
+}
+
+void ThreadPool::work() {
+    std::unique_lock<std::mutex> lock{mx_};
+    unsigned long batch = 0;
+    while (true) {
+        work_cv_.wait(lock, [&] { return break_ || batch != batch_; });
+        if (break_) {
+            return;
+        }
+        batch = batch_;
+        run_tasks(lock);
+    }
+}
+
+void ThreadPool::run(size_t count, const std::function<void(size_t)>& task) {
+    std::unique_lock<std::mutex> lock{mx_};
+    task_ = &task;
+    count_ = count;
+    next_ = 0;
+    ++batch_;
+    work_cv_.notify_all();
+    run_tasks(lock);
+    done_cv_.wait(lock, [&] { return running_ == 0 && next_ == count_; });
+    task_ = nullptr;
+    if (ex_) {
+        std::exception_ptr ex;
+        std::swap(ex, ex_);
+        std::rethrow_exception(ex);
+    }
+}
+
+}
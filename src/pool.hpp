@@ -0,0 +1,47 @@
+#pragma once
+#include "types.hpp"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+
+namespace olo {
+
+// Fixed set of threads running batches of independent tasks, the calling
+// thread takes part in each batch too.
+class ThreadPool {
+    vector<std::thread> threads_;
+    std::mutex mx_;
+    std::condition_variable work_cv_;
+    std::condition_variable done_cv_;
+    const std::function<void(size_t)>* task_ = nullptr;
+    size_t count_ = 0;
+    size_t next_ = 0;
+    // Tasks started and not finished yet
+    size_t running_ = 0;
+    // Incremented with each batch, so that workers don't miss one
+    unsigned long batch_ = 0;
+    bool break_ = false;
+    std::exception_ptr ex_;
+
+    void work();
+    void run_tasks(std::unique_lock<std::mutex>& lock);
+
+public:
+    // Pool of `thread_count` threads besides the calling one, zero runs everything on the caller.
+    explicit ThreadPool(size_t thread_count);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    vector<std::thread>& threads() { return threads_; }
+
+    // Runs task(i) for each i in [0, count) and returns once all of them are done.
+    // Rethrows the first exception thrown by a task.
+    void run(size_t count, const std::function<void(size_t)>& task);
+};
+
+}
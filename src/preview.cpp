@@ -0,0 +1,177 @@
+#include "preview.hpp"
+#include "log.hpp"
+
+#include <boost/format.hpp>
+
+#include <stdexcept>
+#include <cstring>
+#include <cmath>
+
+namespace olo {
+using std::runtime_error;
+using boost::format;
+
+namespace {
+const double PI = 3.14159265358979323846;
+// Frames mixed down at once
+const size_t CHUNK_FRAMES = 1024;
+// Filter length in input samples per decimation factor, each side of the center tap
+const size_t TAPS_PER_FACTOR = 8;
+// Filter passes this fraction of the preview Nyquist frequency
+const double PASSBAND = .9;
+// Partial sums of a dot product, a multiple of any SIMD width the compiler targets
+const size_t ACCUMULATORS = 8;
+
+// Independent partial sums let the compiler vectorize the loop without reassociating
+// float additions, which it isn't allowed to do on its own.
+inline float dot(const float* taps, const float* x, size_t size) {
+    float acc[ACCUMULATORS] = {0};
+    for (size_t k = 0; k != size; k += ACCUMULATORS) {
+        for (size_t l = 0; l != ACCUMULATORS; ++l) {
+            acc[l] += taps[k + l] * x[k + l];
+        }
+    }
+    float sum = 0.f;
+    for (size_t l = 0; l != ACCUMULATORS; ++l) {
+        sum += acc[l];
+    }
+    return sum;
+}
+}
+
+PreviewWriter::PreviewWriter(
+    const string& path,
+    size_t sample_rate,
+    size_t channel_count,
+    size_t buffer_size,
+    const vector<vector<size_t>>& mix,
+    size_t preview_rate
+):
+    IoWorker{sample_rate, channel_count, buffer_size},
+    mix_{mix},
+    factor_{std::max<size_t>(static_cast<size_t>(sample_rate / (double)preview_rate + .5), 1)},
+    chunk_(CHUNK_FRAMES * channel_count)
+{
+    for (auto& group: mix_) {
+        for (auto c: group) {
+            if (c >= channel_count_) {
+                throw runtime_error{str(format("preview mixes channel %1%, recording has %2% channels")
+                    % (c + 1) % channel_count_)};
+            }
+        }
+    }
+    // Windowed sinc, or a single tap when not decimating at all
+    const size_t length = factor_ == 1 ? 1 : 2 * TAPS_PER_FACTOR * factor_ + 1;
+    delay_ = (length - 1) / 2;
+    const size_t padded = (length + ACCUMULATORS - 1) / ACCUMULATORS * ACCUMULATORS;
+    taps_.assign(padded, 0.f);
+    const double cutoff = PASSBAND * .5 / factor_;
+    vector<double> h(length, 1.);
+    double sum = 0.;
+    for (size_t n = 0; n != length && length != 1; ++n) {
+        const double x = n - (double)delay_;
+        const double sinc = x == 0 ? 2 * cutoff : std::sin(2 * PI * cutoff * x) / (PI * x);
+        const double blackman = .42 - .5 * std::cos(2 * PI * n / (length - 1)) + .08 * std::cos(4 * PI * n / (length - 1));
+        h[n] = sinc * blackman;
+        sum += h[n];
+    }
+    for (size_t n = 0; n != length; ++n) {
+        taps_[padded - 1 - n] = length == 1 ? 1.f : h[n] / sum;
+    }
+    for (size_t o = 0; o != mix_.size(); ++o) {
+        mixed_.emplace_back(taps_.size() - 1 + CHUNK_FRAMES);
+    }
+    out_.resize((CHUNK_FRAMES / factor_ + 1) * mix_.size());
+    // First output is centered at the first recorded frame
+    phase_ = delay_;
+
+    SF_INFO si = {0};
+    si.channels = mix_.size();
+    si.samplerate = sample_rate_ / factor_;
+    si.format = SF_FORMAT_FLAC | SF_FORMAT_PCM_16;
+    sf_ = open_sndfile(path, SFM_WRITE, si);
+    // Loud input saturates instead of wrapping around
+    sf_command(sf_.get(), SFC_SET_CLIPPING, nullptr, SF_TRUE);
+    ldebug("PreviewWriter: %zd channels at %zd sample rate into %s, %zd taps\n",
+        mix_.size(), sample_rate_ / factor_, path.c_str(), length);
+    thread_.reset(new std::thread(&PreviewWriter::pump, this));
+}
+
+PreviewWriter::~PreviewWriter() {
+    stop();
+}
+
+void PreviewWriter::push(const Sample* frames, size_t frame_count) {
+    auto ring = buffer();
+    const size_t n = std::min(frame_count, jack_ringbuffer_write_space(ring) / frame_size_);
+    jack_ringbuffer_write(ring, reinterpret_cast<const char*>(frames), n * frame_size_);
+    if (n != frame_count) {
+        skipped_ += frame_count - n;
+    }
+    wake();
+}
+
+void PreviewWriter::process(size_t frame_count) {
+    const size_t history = taps_.size() - 1;
+    const size_t outputs = mix_.size();
+    for (size_t o = 0; o != outputs; ++o) {
+        float* x = mixed_[o].data() + history;
+        std::fill(x, x + frame_count, 0.f);
+        for (auto c: mix_[o]) {
+            for (size_t i = 0; i != frame_count; ++i) {
+                x[i] += chunk_[i * channel_count_ + c];
+            }
+        }
+        const float gain = 1.f / mix_[o].size();
+        for (size_t i = 0; i != frame_count; ++i) {
+            x[i] *= gain;
+        }
+    }
+    size_t n = 0;
+    size_t i = phase_;
+    for (; i < frame_count; i += factor_, ++n) {
+        for (size_t o = 0; o != outputs; ++o) {
+            out_[n * outputs + o] = dot(taps_.data(), mixed_[o].data() + i, taps_.size());
+        }
+    }
+    phase_ = i - frame_count;
+    for (auto& x: mixed_) {
+        std::memmove(x.data(), x.data() + frame_count, history * sizeof(float));
+    }
+    if (n != 0) {
+        const sf_count_t written = sf_writef_float(sf_.get(), out_.data(), n);
+        if (written != static_cast<sf_count_t>(n)) {
+            throw runtime_error{str(format("unexpected write of %1% preview frames when requested %2%, disk full?")
+                % written % n)};
+        }
+        output_frames_ += n;
+    }
+}
+
+void PreviewWriter::work_cycle() {
+    auto ring = buffer();
+    size_t readable = jack_ringbuffer_read_space(ring) / frame_size_;
+    while (readable != 0) {
+        const size_t count = std::min(readable, CHUNK_FRAMES);
+        jack_ringbuffer_read(ring, reinterpret_cast<char*>(chunk_.data()), count * frame_size_);
+        process(count);
+        readable -= count;
+        done_ += count;
+    }
+}
+
+void PreviewWriter::flush() {
+    work_cycle();
+    // Push the filter's delay line out, so the preview covers the recording to its end
+    std::fill(chunk_.begin(), chunk_.end(), 0.f);
+    for (size_t left = delay_; left != 0; ) {
+        const size_t count = std::min(left, CHUNK_FRAMES);
+        process(count);
+        left -= count;
+    }
+    sf_.reset();
+    ldebug("PreviewWriter::flush(): %zd frames written, %zd recorded frames skipped\n",
+        output_frames_, skipped_.load());
+}
+
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include "types.hpp"
+#include "io.hpp"
+
+#include <atomic>
+
+namespace olo {
+
+// Low-rate preview of a recording, written next to it while recording: groups of
+// recorded channels are mixed down, low-pass filtered and decimated into a 16-bit
+// FLAC file. Writer hands over the frames it records without ever waiting, frames
+// which don't fit into the ringbuffer are skipped, and all the work is done here.
+class PreviewWriter: public IoWorker {
+    // Recorded channels mixed into each preview channel, averaged
+    vector<vector<size_t>> mix_;
+    size_t factor_;
+    // Low-pass filter taps in reverse order, zero-padded in front to a multiple of
+    // the accumulator count, so each output is a plain dot product over history.
+    vector<float> taps_;
+    // Input samples the filter delays its output by, compensated on both ends
+    size_t delay_;
+    // Per preview channel: taps_.size() - 1 mixed samples of history followed by current chunk
+    vector<vector<float>> mixed_;
+    vector<Sample> chunk_;
+    vector<Sample> out_;
+    // Position of next output in current chunk
+    size_t phase_;
+    size_t output_frames_ = 0;
+    // Frames Writer couldn't hand over because the ringbuffer was full
+    std::atomic<size_t> skipped_{0};
+
+    void work_cycle() override;
+    void flush() override;
+    void process(size_t frame_count);
+
+public:
+    explicit PreviewWriter(
+        const string& path,
+        size_t sample_rate,
+        size_t channel_count,
+        size_t buffer_size,
+        const vector<vector<size_t>>& mix,
+        size_t preview_rate
+    );
+    ~PreviewWriter();
+
+    size_t preview_rate() const { return sample_rate_ / factor_; }
+    size_t preview_channels() const { return mix_.size(); }
+    size_t frames_written() const { return output_frames_; }
+    size_t frames_skipped() const { return skipped_; }
+
+    // Called from Writer thread with interleaved recorded frames, never blocks.
+    void push(const Sample* frames, size_t frame_count);
+};
+
+}
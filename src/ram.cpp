@@ -0,0 +1,146 @@
+#include "ram.hpp"
+#include "encoder.hpp"
+#include "log.hpp"
+
+#include <boost/format.hpp>
+
+#include <stdexcept>
+#include <new>
+#include <cerrno>
+#include <cstring>
+
+#ifndef _WIN32
+# include <sys/mman.h>
+#endif
+
+namespace olo {
+using std::runtime_error;
+using boost::format;
+
+namespace {
+// Frames handed to libsndfile or encoder at once when saving
+const size_t SAVE_FRAMES = 65536;
+}
+
+RamRecorder::RamRecorder(
+    const string& path,
+    size_t sample_rate,
+    size_t channel_count,
+    size_t frame_count,
+    FileFormat file_format,
+    size_t encoder_threads
+):
+    path_{path},
+    sample_rate_{sample_rate},
+    channel_count_{channel_count},
+    format_{file_format},
+    encoder_threads_{encoder_threads},
+    arena_size_{frame_count * channel_count * sizeof(Sample)},
+    needed_{frame_count}
+{
+    if (needed_ == 0) {
+        throw runtime_error{"recording to memory requires a known duration"};
+    }
+    if (format_ == FileFormat::FLAC && STDIO_PATH == path_) {
+        throw runtime_error{"FLAC recording can't be written to stdout"};
+    }
+    // Value-initialized, so every page is touched before the first cycle
+    arena_.reset(new (std::nothrow) Sample[frame_count * channel_count]());
+    if (!arena_) {
+        throw runtime_error{str(format("unable to allocate %1% bytes for recording to memory")
+            % arena_size_)};
+    }
+#ifndef _WIN32
+    if (mlock(arena_.get(), arena_size_) == 0) {
+        locked_ = true;
+    } else {
+        lerror("RamRecorder: locking %zd bytes failed with %s, recording may page fault\n",
+            arena_size_, std::strerror(errno));
+    }
+#endif
+    ldebug("RamRecorder: recording %zd frames of %zd channels into %zd bytes of memory\n",
+        needed_, channel_count_, arena_size_);
+}
+
+RamRecorder::~RamRecorder() {
+    if (saver_) {
+        saver_->join();
+    }
+#ifndef _WIN32
+    if (locked_) {
+        munlock(arena_.get(), arena_size_);
+    }
+#endif
+}
+
+void RamRecorder::record(const Sample* const* channels, size_t frame_count) {
+    frame_count = std::min(frame_count, needed_ - done_);
+    Sample* frames = arena_.get() + done_ * channel_count_;
+    for (size_t c = 0; c != channel_count_; ++c) {
+        const Sample* channel = channels[c];
+        for (size_t i = 0; i != frame_count; ++i) {
+            frames[i * channel_count_ + c] = channel[i];
+        }
+    }
+    done_ += frame_count;
+}
+
+void RamRecorder::skip(size_t frame_count) {
+    // Arena is zeroed, skipped frames stay silent
+    done_ += std::min(frame_count, needed_ - done_);
+}
+
+void RamRecorder::write_file() {
+    const bool stdio = STDIO_PATH == path_;
+    ldebug("RamRecorder::write_file(): writing %zd frames to %s\n", done_, stdio ? "stdout" : path_.c_str());
+    if (format_ == FileFormat::FLAC) {
+        ParallelEncoder encoder{path_, sample_rate_, channel_count_, SAVE_FRAMES, encoder_threads_};
+        for (size_t pos = 0; pos < done_; pos += SAVE_FRAMES) {
+            encoder.write(arena_.get() + pos * channel_count_, std::min(SAVE_FRAMES, done_ - pos));
+        }
+        encoder.close();
+        return;
+    }
+    SF_INFO si = {0};
+    if (stdio) {
+        init_stdio_info(si, sample_rate_, channel_count_);
+    } else {
+        si.channels = channel_count_;
+        si.samplerate = sample_rate_;
+        si.format = SF_FORMAT_WAV | SF_FORMAT_PCM_32;
+    }
+    auto sf = open_sndfile(path_, SFM_WRITE, si);
+    for (size_t pos = 0; pos < done_; pos += SAVE_FRAMES) {
+        const size_t count = std::min(SAVE_FRAMES, done_ - pos);
+        const sf_count_t written = sf_writef_float(sf.get(), arena_.get() + pos * channel_count_, count);
+        if (written != static_cast<sf_count_t>(count)) {
+            throw runtime_error{str(format("unexpected write of %1% frames when requested %2%, disk full?")
+                % written % count)};
+        }
+    }
+}
+
+void RamRecorder::save() {
+    saver_.reset(new std::thread([this] {
+        try {
+            write_file();
+        } catch (...) {
+            lerror("RamRecorder::save(): exception while saving, will be rethrown on join()\n");
+            ex_ = std::current_exception();
+        }
+    }));
+}
+
+void RamRecorder::join() {
+    if (saver_) {
+        saver_->join();
+        saver_.reset();
+    }
+    if (ex_) {
+        std::exception_ptr ex;
+        std::swap(ex_, ex);
+        std::rethrow_exception(ex);
+    }
+}
+
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include "types.hpp"
+#include "io.hpp"
+
+#include <memory>
+#include <thread>
+#include <exception>
+
+namespace olo {
+
+// Records a take of known length into an arena allocated, locked and touched
+// upfront. Written to directly from the RT thread, so there is neither a worker
+// to wake up nor any disk activity while capturing; the file is written only
+// after the session has finished.
+class RamRecorder {
+    string path_;
+    size_t sample_rate_;
+    size_t channel_count_;
+    FileFormat format_;
+    size_t encoder_threads_;
+    std::unique_ptr<Sample[]> arena_;
+    size_t arena_size_ = 0;
+    bool locked_ = false;
+    // Capacity of the arena in frames
+    size_t needed_;
+    // Number of frames recorded or skipped so far
+    size_t done_ = 0;
+    std::unique_ptr<std::thread> saver_;
+    // Stores exception thrown while saving for rethrow in join()
+    std::exception_ptr ex_;
+
+    void write_file();
+
+public:
+    explicit RamRecorder(
+        const string& path,
+        size_t sample_rate,
+        size_t channel_count,
+        size_t frame_count,
+        FileFormat file_format = FileFormat::WAV,
+        size_t encoder_threads = 1
+    );
+    ~RamRecorder();
+
+    RamRecorder(const RamRecorder&) = delete;
+    RamRecorder& operator=(const RamRecorder&) = delete;
+
+    size_t channel_count() const { return channel_count_; }
+    size_t sample_rate() const { return sample_rate_; }
+    size_t frames_needed() const { return needed_; }
+    size_t frames_done() const { return done_; }
+    bool finished() const { return done_ == needed_; }
+    bool locked() const { return locked_; }
+
+    // Called from RT thread with per-channel buffers of `frame_count` samples.
+    void record(const Sample* const* channels, size_t frame_count);
+    // Called from RT thread for frames lost in xruns, leaving silence in their place.
+    void skip(size_t frame_count);
+    // Starts writing recorded frames to the file in background.
+    void save();
+    // Waits for save() to finish and rethrows its error, if any.
+    void join();
+};
+
+}
@@ -1,218 +1,339 @@
 #include "reactor.hpp"
 #include "jack_client.hpp"
+#include "session.hpp"
 #include "io.hpp"
+#include "shm.hpp"
+#include "ram.hpp"
+#include "soak.hpp"
+#include "spectrum.hpp"
 #include "log.hpp"
 
 #include <jack/jack.h>
+#include <jack/transport.h>
 
 #include <boost/format.hpp>
 
 #include <memory>
 #include <stdexcept>
 #include <chrono>
+#include <set>
 #include <cstring>
-#include <csignal>
 
 namespace olo {
-using std::unique_ptr;
 using std::runtime_error;
-using std::signal;
 using boost::format;
 
 namespace {
-struct PortDeleter {
-    JackClient& client;
-    void operator()(jack_port_t* port) const {
-        jack_port_unregister(client.handle(), port);
-    }
-};
+const auto SIGNAL_POLL_INTERVAL = std::chrono::milliseconds(100);
 
-auto create_port(JackClient& client, const string& name, int flags) {
-    unique_ptr<jack_port_t, PortDeleter> port {
-        jack_port_register(client.handle(), name.c_str(), JACK_DEFAULT_AUDIO_TYPE, flags, 0),
-        PortDeleter{client}
-    };
-    if (!port) {
-        throw runtime_error{str(format("failed creating port %1%") % name)};
-    }
-    return port;
+double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
 }
 
-Reactor* instance = nullptr;
-const int SIGNALS_INTERCEPT[] = {
-    SIGINT,
-    SIGTERM,
-#ifdef SIGQUIT
-    SIGQUIT,
-#endif
-#ifdef SIGHUP
-    SIGHUP,
-#endif
-};
+void Reactor::validate_ports(const vector<string>& input_ports, const vector<string>& output_ports) const {
+    if (soak_ && soak_->self_loopback()) {
+        // Only own ports get connected
+        return;
+    }
+    // Snapshots of the graph by direction answer both existence and direction, instead of
+    // finding out port by port halfway through connecting
+    const auto outputs_found = client_.enumerate_ports(JackPortIsOutput, true);
+    const auto inputs_found = client_.enumerate_ports(JackPortIsInput, true);
+    const std::set<string> outputs{outputs_found.begin(), outputs_found.end()};
+    const std::set<string> inputs{inputs_found.begin(), inputs_found.end()};
+    vector<string> problems;
+    auto check = [&](const string& peer, const std::set<string>& wanted, const std::set<string>& other,
+            int direction, const char* what) {
+        if (wanted.count(peer)) {
+            return;
+        }
+        if (!other.count(peer)) {
+            // Ports may also be given by alias, which only lookup by name resolves
+            auto port = jack_port_by_name(client_.handle(), peer.c_str());
+            if (!port) {
+                problems.push_back(str(format("no such port %1%") % peer));
+                return;
+            }
+            if (jack_port_flags(port) & direction) {
+                return;
+            }
+        }
+        problems.push_back(str(format("%1% isn't %2% port") % peer % what));
+    };
+    if (capturing()) {
+        for (auto& peer: input_ports) {
+            check(peer, outputs, inputs, JackPortIsOutput, "a capture");
+        }
+    }
+    if (playing()) {
+        for (auto& peer: output_ports) {
+            if (NULL_OUTPUT != peer) {
+                check(peer, inputs, outputs, JackPortIsInput, "a playback");
+            }
+        }
+    }
+    if (!problems.empty()) {
+        string message = "can't connect ports: " + problems.front();
+        for (size_t i = 1; i != problems.size(); ++i) {
+            message += "; " + problems[i];
+        }
+        throw runtime_error{message};
+    }
 }
 
 void Reactor::register_ports(const vector<string>& input_ports, const vector<string>& output_ports) {
-    if (writer_ != nullptr) {
+    const bool self_loopback = soak_ && soak_->self_loopback();
+    auto acquire = [&](bool input, size_t index, const string& peer) {
+        SessionManager::PortOrigin origin;
+        auto port = sessions_.acquire_port(SessionManager::port_name(id_, input, index), input,
+            self_loopback ? "" : peer, origin);
+        switch (origin) {
+        case SessionManager::PortOrigin::REGISTERED: ++setup_.ports_registered; break;
+        case SessionManager::PortOrigin::PREREGISTERED: ++setup_.ports_preregistered; break;
+        case SessionManager::PortOrigin::REUSED: ++setup_.ports_reused; break;
+        }
+        return port;
+    };
+    if (capturing()) {
         inputs_.reserve(input_ports.size());
         input_names_.reserve(input_ports.size());
         for (size_t i = 0; i != input_ports.size(); ++i) {
-            auto short_name = str(format("input_%1%") % i);
-            auto port = create_port(client_, short_name, JackPortIsInput);
-            input_names_.push_back(string{client_.name()} + ":" + short_name);
-            inputs_.push_back(port.release());
+            inputs_.push_back(acquire(true, i, input_ports[i]));
+            input_names_.push_back(jack_port_name(inputs_.back()));
         }
         input_buffers_.resize(input_ports.size());
     }
-    if (reader_ != nullptr) {
+    if (playing()) {
         outputs_.reserve(output_ports.size());
         output_names_.reserve(output_ports.size());
         for (size_t i = 0; i != output_ports.size(); ++i) {
-            auto short_name = str(format("output_%1%") % i);
-            output_names_.push_back(string{client_.name()} + ":" + short_name);
             if (NULL_OUTPUT != output_ports[i]) {
-                auto port = create_port(client_, short_name, JackPortIsOutput);
-                outputs_.push_back(port.release());
+                outputs_.push_back(acquire(false, i, output_ports[i]));
+                output_names_.push_back(jack_port_name(outputs_.back()));
             } else {
                 outputs_.push_back(nullptr);
+                output_names_.push_back(string{client_.name()} + ":" + SessionManager::port_name(id_, false, i));
             }
         }
         output_buffers_.resize(output_ports.size());
     }
 }
 
+bool Reactor::keep_connection(jack_port_t* port, const string& peer) {
+    const int count = jack_port_connected(port);
+    if (count == 1 && jack_port_connected_to(port, peer.c_str())) {
+        return true;
+    }
+    if (count != 0) {
+        // Reused port, still connected where a previous session wanted it
+        jack_port_disconnect(client_.handle(), port);
+    }
+    return false;
+}
+
+void Reactor::connect_port(jack_port_t* port, const string& peer, const string& source, const string& destination) {
+    if (keep_connection(port, peer)) {
+        ++setup_.connections_reused;
+        return;
+    }
+    int err = jack_connect(client_.handle(), source.c_str(), destination.c_str());
+    if (0 != err) {
+        throw runtime_error{str(format("failed connecting port %1% to %2% with Jack error %3%")
+            % source % destination % err)};
+    }
+    ++setup_.connections_made;
+}
+
 void Reactor::connect_ports(const vector<string>& input_ports, const vector<string>& output_ports) {
-    if (writer_ != nullptr) {
+    if (soak_ && soak_->self_loopback()) {
+        // Signal goes from own outputs straight back into own inputs
+        for (size_t i = 0; i != outputs_.size(); ++i) {
+            keep_connection(inputs_[i], output_names_[i]);
+            connect_port(outputs_[i], input_names_[i], output_names_[i], input_names_[i]);
+        }
+        return;
+    }
+    if (capturing()) {
         for (size_t i = 0; i != input_ports.size(); ++i) {
-            int err = jack_connect(client_.handle(), input_ports[i].c_str(), input_names_[i].c_str());
-            if (0 != err) {
-                throw runtime_error{str(format("failed connecting port %1% to %2% with Jack error %3%")
-                    % input_ports[i] % input_names_[i] % err)};
-            }
+            connect_port(inputs_[i], input_ports[i], input_ports[i], input_names_[i]);
         }
     }
-    if (reader_ != nullptr) {
+    if (playing()) {
         for (size_t i = 0; i != output_ports.size(); ++i) {
             if (!outputs_[i]) {
                 // This is NULL_OUTPUT, leave disconnected
                 continue;
             }
-            int err = jack_connect(client_.handle(), output_names_[i].c_str(), output_ports[i].c_str());
-            if (0 != err) {
-                throw runtime_error{str(format("failed connecting port %1% to %2% with Jack error %3%")
-                    % output_names_[i] % output_ports[i] % err)};
-            }
+            connect_port(outputs_[i], output_ports[i], output_names_[i], output_ports[i]);
         }
     }
 }
 
-void Reactor::activate() {
-    assert(!activated_);
-    int err;
-    if (0 != (err = jack_activate(client_.handle()))) {
-        throw runtime_error{str(format("failed activating Jack client with error %1%") % err)};
-    } else {
-        ldebug("Reactor::activate(): Jack client activated\n");
-        activated_ = true;
-    }
-}
-
-void Reactor::deactivate() {
-    if (activated_) {
-        jack_deactivate(client_.handle());
-        ldebug("Reactor::deactivate(): Jack client deactivated\n");
-        activated_ = false;
-    }
-}
-
 Reactor::Reactor(
-    JackClient& client,
+    SessionManager& sessions,
     const vector<string>& input_ports,
     const vector<string>& output_ports,
     Reader* reader,
     Writer* writer,
-    bool duration_infinite
+    ShmPublisher* publisher,
+    bool duration_infinite,
+    const StartCondition& start,
+    bool preserve_timeline,
+    XrunLog* xrun_log,
+    RamRecorder* ram,
+    SoakTest* soak,
+    SpectrumAnalyzer* analyzer
 ):
-    client_{client},
+    sessions_{sessions},
+    client_{sessions.client()},
+    id_{sessions.next_id()},
     reader_{reader},
     writer_{writer},
+    publisher_{publisher},
+    xrun_log_{xrun_log},
+    ram_{ram},
+    soak_{soak},
+    analyzer_{analyzer},
+    preserve_timeline_{preserve_timeline},
     needed_{
         duration_infinite
             ? 0
-            : std::max(
+            : std::max({
                 reader ? reader->frames_needed() : 0,
-                writer ? writer->frames_needed() : 0
-            )
-    }
+                writer ? writer->frames_needed() : 0,
+                publisher ? publisher->frames_needed() : 0,
+                ram ? ram->frames_needed() : 0,
+                soak ? soak->frames_needed() : 0,
+                analyzer ? analyzer->frames_needed() : 0
+            })
+    },
+    until_playback_end_{!duration_infinite && needed_ == 0 && reader != nullptr},
+    start_{start}
 {
     if (needed_ != 0) {
         ldebug("Reactor::Reactor(): processing at most %zd frames\n", needed_);
+    } else if (until_playback_end_) {
+        ldebug("Reactor::Reactor(): processing until end of playback stream\n");
     } else {
         ldebug("Reactor::Reactor(): processing until explicitly terminated\n");
     }
-    if (instance != nullptr) {
-        throw runtime_error{"reactor instance is already present"};
-    } else {
-        instance = this;
-    }
-    register_ports(input_ports, output_ports);
-    int err;
-    if (0 != (err = jack_set_process_callback(client_.handle(), process_, this)))  {
-        throw runtime_error{str(format("failed setting Jack process callback with error %1%") % err)};
+    if (start_.frame) {
+        ldebug("Reactor::Reactor(): armed to start at frame %u\n", *start_.frame);
+    } else if (start_.transport) {
+        ldebug("Reactor::Reactor(): armed to start with Jack transport\n");
     }
-    jack_on_shutdown(client_.handle(), shutdown_, this);
-    for (int sig: SIGNALS_INTERCEPT) {
-        signal(sig, signal_handler_);
-    }
-    activate();
+    const auto setup_start = std::chrono::steady_clock::now();
+    validate_ports(input_ports, output_ports);
+    setup_.validate_secs = seconds_since(setup_start);
     try {
+        auto step_start = std::chrono::steady_clock::now();
+        register_ports(input_ports, output_ports);
+        setup_.register_secs = seconds_since(step_start);
+        // Connections are only possible on an active client; connecting before the
+        // session is added means its first cycle already sees the signal.
+        step_start = std::chrono::steady_clock::now();
+        sessions_.ensure_active();
+        setup_.activate_secs = seconds_since(step_start);
+        step_start = std::chrono::steady_clock::now();
         connect_ports(input_ports, output_ports);
+        setup_.connect_secs = seconds_since(step_start);
+        sessions_.add(this);
     } catch (...) {
-        lerror("Reactor::Reactor(): exception while connecting ports, rethrowing after deactivate\n");
-        deactivate();
+        lerror("Reactor::Reactor(): exception while setting up ports, rethrowing after releasing them\n");
+        release_ports();
         throw;
     }
+    setup_.total_secs = seconds_since(setup_start);
+    ldebug("Reactor::Reactor(): ports set up in %.1f ms, %zd registered, %zd preregistered, %zd reused, "
+        "%zd connections made, %zd reused\n", setup_.total_secs * 1000., setup_.ports_registered,
+        setup_.ports_preregistered, setup_.ports_reused, setup_.connections_made, setup_.connections_reused);
 }
 
 Reactor::~Reactor() {
-    deactivate();
-    // Restore original signal handlers
-    for (int sig: SIGNALS_INTERCEPT) {
-        signal(sig, SIG_DFL);
-    }
+    sessions_.remove(this);
+    const auto start = std::chrono::steady_clock::now();
+    release_ports();
+    ldebug("Reactor::~Reactor(): ports released in %.1f ms\n", seconds_since(start) * 1000.);
+}
+
+void Reactor::release_ports() {
     for (auto& port: inputs_) {
-        jack_port_disconnect(client_.handle(), port);
-        jack_port_unregister(client_.handle(), port);
+        sessions_.release_port(port, true);
     }
     for (auto& port: outputs_) {
-        if (!port) {
-            continue;
+        if (port) {
+            sessions_.release_port(port, false);
         }
-        jack_port_disconnect(client_.handle(), port);
-        jack_port_unregister(client_.handle(), port);
-    }
-    if (instance == this) {
-        instance = nullptr;
     }
+    inputs_.clear();
+    outputs_.clear();
 }
 
 void Reactor::signal_finished() {
-    if (!finished_fired_) {
-        finished_fired_ = true;
+    if (!finished_fired_.exchange(true)) {
         finished_.set_value();
     }
 }
 
 void Reactor::wait_finished() {
-    finished_.get_future().wait();
-    deactivate();
-    ldebug("Reactor::wait_finished(): done processing %zd frames\n    overruns: %zd\n    underruns: %zd\n", done_, overruns_, underruns_);
+    auto finished = finished_.get_future();
+    // RT thread normally stops us on a signal, but it may not be calling us (anymore)
+    while (finished.wait_for(SIGNAL_POLL_INTERVAL) != std::future_status::ready) {
+        if (int sig = SessionManager::take_signal()) {
+            linfo("Reactor::wait_finished(): stopping on signal %d\n", sig);
+            stop();
+        }
+    }
+    sessions_.remove(this);
+    ldebug("Reactor::wait_finished(): done processing %zd frames\n    overruns: %zd\n    underruns: %zd\n    xruns: %zd\n",
+        done_, overruns_, underruns_, xruns_);
+    // Rethrows exception from RT thread, if any
+    finished.get();
 }
 
-void Reactor::playback(size_t frame_count) {
+bool Reactor::try_start(size_t frame_count, size_t& offset) {
+    const jack_nframes_t cycle_start = jack_last_frame_time(client_.handle());
+    offset = 0;
+    if (start_.frame) {
+        // Frame time wraps around, so compare the distance
+        auto delta = static_cast<int32_t>(*start_.frame - cycle_start);
+        if (delta >= static_cast<int32_t>(frame_count)) {
+            return false;
+        }
+        if (delta < 0) {
+            lerror("Reactor::process(): start frame %u has already passed, starting %d frames late\n",
+                *start_.frame, -delta);
+        } else {
+            offset = delta;
+        }
+    } else if (start_.transport) {
+        if (jack_transport_query(client_.handle(), nullptr) != JackTransportRolling) {
+            return false;
+        }
+    }
+    started_ = true;
+    start_frame_ = cycle_start + offset;
+    ldebug("Reactor::process(): starting at frame %u\n", *start_frame_);
+    return true;
+}
+
+void Reactor::mute(size_t frame_count) {
+    for (auto port: outputs_) {
+        if (!port) {
+            continue;
+        }
+        auto buff = static_cast<Sample*>(jack_port_get_buffer(port, frame_count));
+        if (buff != nullptr) {
+            std::memset(buff, 0, sizeof(Sample) * frame_count);
+        }
+    }
+}
+
+void Reactor::playback(size_t offset, size_t frame_count) {
     assert(reader_ != nullptr);
     const auto channels = reader_->channel_count();
-    size_t n, c;
-    // Update buffer pointers
+    // Update buffer pointers, frames before `offset` are muted
     for (size_t c = 0; c != channels; ++c) {
         if (!outputs_[c]) {
             continue;
@@ -222,132 +343,222 @@ void Reactor::playback(size_t frame_count) {
             throw runtime_error{str(format("unable to obtain playback buffer for port %1%")
                 % output_names_[c])};
         }
+        std::memset(output_buffers_[c], 0, sizeof(Sample) * offset);
+        output_buffers_[c] += offset;
+    }
+    frame_count -= offset;
+    auto ring = reader_->buffer();
+    const size_t frame_size = reader_->frame_size();
+    size_t readable = jack_ringbuffer_read_space(ring) / frame_size;
+    if (playback_debt_ != 0) {
+        // Skip frames which were due while we had nothing to play, to get back on timeline
+        const size_t skip = std::min(playback_debt_, readable);
+        jack_ringbuffer_read_advance(ring, skip * frame_size);
+        playback_debt_ -= skip;
+        readable -= skip;
     }
-    // Demultiplex samples into port buffers
-    for (n = 0; n != frame_count; ++n) {
-        bool break_outer = false;
-        for (c = 0; c != channels; ++c) {
+    const size_t n = playback_debt_ == 0 ? std::min(frame_count, readable) : 0;
+    // Demultiplex whole frames into port buffers
+    for (size_t i = 0; i != n; ++i) {
+        for (size_t c = 0; c != channels; ++c) {
             Sample discard;
-            Sample* buff = outputs_[c] ? &output_buffers_[c][n] : &discard;
-            size_t read = jack_ringbuffer_read(
-                reader_->buffer(),
-                reinterpret_cast<char*>(buff),
-                sizeof(Sample)
-            );
-            if (read != sizeof(Sample)) {
-                if (!reader_->finished()) {
-                    lerror("Reactor::playback(): ringbuffer read failed, UNDERRUN\n");
-                    ++underruns_;
-                }
-                break_outer = true;
-                break;
-            }
-        }
-        if (break_outer) {
-            break;
+            Sample* buff = outputs_[c] ? &output_buffers_[c][i] : &discard;
+            jack_ringbuffer_read(ring, reinterpret_cast<char*>(buff), sizeof(Sample));
         }
     }
-    // Signal reader we're done
-    if (!reader_->finished()) {
-        reader_->wake();
+    if (n != 0 && !first_sample_time_) {
+        first_sample_time_ = jack_get_time();
     }
-    // Mute the remaining samples in case of underrun or stream end
     if (n != frame_count) {
-        for (c = 0; c != channels; ++c) {
+        if (!reader_->finished()) {
+            lerror("Reactor::playback(): ringbuffer read failed, UNDERRUN\n");
+            ++underruns_;
+            report_xrun(XrunCause::PLAYBACK_UNDERRUN, done_ + n, cycle_frame_ + n, frame_count - n);
+            if (preserve_timeline_) {
+                playback_debt_ += frame_count - n;
+            }
+        } else if (until_playback_end_) {
+            ldebug("Reactor::playback(): signalling done to control thread at end of playback stream\n");
+            signal_finished();
+        }
+        // Mute the remaining samples in case of underrun or stream end
+        for (size_t c = 0; c != channels; ++c) {
             if (!outputs_[c]) {
                 continue;
             }
             std::memset(&output_buffers_[c][n], 0, sizeof(Sample) * (frame_count - n));
         }
     }
+    // Signal reader we're done
+    if (!reader_->finished()) {
+        reader_->wake();
+    }
 }
 
-void Reactor::capture(size_t frame_count) {
-    assert(writer_ != nullptr);
-    if (writer_->finished()) {
+void Reactor::capture(size_t offset, size_t frame_count) {
+    assert(capturing());
+    if ((!writer_ || writer_->finished()) && (!publisher_ || publisher_->finished()) && (!ram_ || ram_->finished())
+            && !analyzer_) {
         // Don't even bother, drop samples into vacuum
         return;
     }
-    const auto channels = writer_->channel_count();
-    size_t n, c;
-    // Update buffer pointers
+    const auto channels = input_buffers_.size();
+    // Update buffer pointers, frames before `offset` are skipped
     for (size_t c = 0; c != channels; ++c) {
         input_buffers_[c] = static_cast<const Sample*>(jack_port_get_buffer(inputs_[c], frame_count));
         if (input_buffers_[c] == nullptr) {
             throw runtime_error{str(format("unable to obtain capture buffer for port %1%")
-                % input_buffers_[c])};
-        }
-    }
-    // Multiplex samples into writer's ringbuffer
-    for (n = 0; n != frame_count; ++n) {
-        bool break_outer = false;
-        for (c = 0; c != channels; ++c) {
-            size_t written = jack_ringbuffer_write(
-                writer_->buffer(),
-                reinterpret_cast<const char*>(&input_buffers_[c][n]),
-                sizeof(Sample)
-            );
-            if (written != sizeof(Sample)) {
-                if (!writer_->finished()) {
-                    lerror("Reactor::capture(): ringbuffer write failed, OVERRUN\n");
-                    ++overruns_;
-                }
-                break_outer = true;
-                break;
-            }
+                % input_names_[c])};
+        }
+        input_buffers_[c] += offset;
+    }
+    frame_count -= offset;
+    if (writer_ && !writer_->finished()) {
+        write_capture(frame_count);
+    }
+    if (ram_ && !ram_->finished()) {
+        ram_->record(input_buffers_.data(), frame_count);
+    }
+    if (publisher_) {
+        publisher_->publish(input_buffers_.data(), frame_count, cycle_frame_, jack_get_time());
+    }
+    if (analyzer_) {
+        // Analyzer drops frames rather than ever holding us up
+        analyzer_->push(input_buffers_.data(), frame_count);
+        analyzer_->wake();
+    }
+}
+
+void Reactor::write_capture(size_t frame_count) {
+    const auto channels = writer_->channel_count();
+    auto ring = writer_->buffer();
+    const size_t n = std::min(frame_count, jack_ringbuffer_write_space(ring) / writer_->frame_size());
+    // Multiplex whole frames into writer's ringbuffer
+    for (size_t i = 0; i != n; ++i) {
+        for (size_t c = 0; c != channels; ++c) {
+            jack_ringbuffer_write(ring, reinterpret_cast<const char*>(&input_buffers_[c][i]), sizeof(Sample));
         }
-        if (break_outer) {
-            break;
+    }
+    captured_ += n;
+    if (n != frame_count) {
+        lerror("Reactor::capture(): ringbuffer write failed, OVERRUN\n");
+        ++overruns_;
+        report_xrun(XrunCause::CAPTURE_OVERRUN, done_ + n, cycle_frame_ + n, frame_count - n);
+        if (preserve_timeline_ && !writer_->post_gap(captured_, frame_count - n)) {
+            lerror("Reactor::capture(): too many gaps pending, recording loses alignment\n");
         }
     }
     // Signal writer we're done
-    if (!writer_->finished()) {
-        writer_->wake();
+    writer_->wake();
+}
+
+void Reactor::soak(size_t offset, size_t frame_count) {
+    const auto channels = soak_->channel_count();
+    // Update buffer pointers, output frames before `offset` are muted and input ones skipped
+    for (size_t c = 0; c != channels; ++c) {
+        output_buffers_[c] = static_cast<Sample*>(jack_port_get_buffer(outputs_[c], frame_count));
+        if (output_buffers_[c] == nullptr) {
+            throw runtime_error{str(format("unable to obtain playback buffer for port %1%")
+                % output_names_[c])};
+        }
+        std::memset(output_buffers_[c], 0, sizeof(Sample) * offset);
+        output_buffers_[c] += offset;
+        input_buffers_[c] = static_cast<const Sample*>(jack_port_get_buffer(inputs_[c], frame_count));
+        if (input_buffers_[c] == nullptr) {
+            throw runtime_error{str(format("unable to obtain capture buffer for port %1%")
+                % input_names_[c])};
+        }
+        input_buffers_[c] += offset;
     }
+    frame_count -= offset;
+    soak_->generate(output_buffers_.data(), frame_count);
+    const size_t n = soak_->capture(input_buffers_.data(), frame_count);
+    if (n != frame_count) {
+        lerror("Reactor::soak(): ringbuffer write failed, OVERRUN\n");
+        ++overruns_;
+        report_xrun(XrunCause::CAPTURE_OVERRUN, done_ + n, cycle_frame_ + n, frame_count - n);
+    }
+    // Signal verifier we're done
+    soak_->wake();
 }
 
-void Reactor::process(size_t frame_count) {
+void Reactor::report_xrun(XrunCause cause, size_t frame, jack_nframes_t jack_frame, size_t frame_count) {
+    if (xrun_log_) {
+        xrun_log_->post({cause, frame, jack_frame, frame_count});
+    }
+}
+
+void Reactor::check_timeline(jack_nframes_t cycle_start) {
+    // Frame time wraps around, so compare the distance
+    auto lost = static_cast<int32_t>(cycle_start - next_cycle_frame_);
+    if (lost <= 0) {
+        return;
+    }
+    lerror("Reactor::process(): %d frames lost in Jack xrun\n", lost);
+    ++xruns_;
+    report_xrun(XrunCause::JACK_XRUN, done_, next_cycle_frame_, lost);
+    if (!preserve_timeline_) {
+        return;
+    }
+    if (writer_ && !writer_->finished() && !writer_->post_gap(captured_, lost)) {
+        lerror("Reactor::process(): too many gaps pending, recording loses alignment\n");
+    }
+    if (ram_ && !ram_->finished()) {
+        ram_->skip(lost);
+    }
     if (reader_) {
-        playback(frame_count);
+        playback_debt_ += lost;
     }
+    done_ += lost;
+}
+
+void Reactor::process(size_t frame_count) {
+    const jack_nframes_t cycle_start = jack_last_frame_time(client_.handle());
+    size_t offset = 0;
+    if (!started_) {
+        if (!try_start(frame_count, offset)) {
+            // Armed, waiting for start condition
+            mute(frame_count);
+            return;
+        }
+    } else {
+        check_timeline(cycle_start);
+    }
+    cycle_frame_ = cycle_start + offset;
+    next_cycle_frame_ = cycle_start + frame_count;
 
-    if (writer_) {
-        capture(frame_count);
+    if (soak_) {
+        soak(offset, frame_count);
+    } else {
+        if (reader_) {
+            playback(offset, frame_count);
+        }
+        if (capturing()) {
+            capture(offset, frame_count);
+        }
     }
 
-    done_ += frame_count;
+    done_ += frame_count - offset;
     if (needed_ != 0 && done_ >= needed_) {
         ldebug("Reactor::process(): signalling done to control thread after %zd frames\n", done_);
         signal_finished();
     }
 }
 
-int Reactor::process_(jack_nframes_t frame_count, void* arg) {
-    Reactor* reactor = static_cast<Reactor*>(arg);
-    assert(reactor != nullptr);
+void Reactor::run(size_t frame_count) {
+    if (failed_) {
+        mute(frame_count);
+        return;
+    }
     try {
-        reactor->process(frame_count);
+        process(frame_count);
     } catch (...) {
-        if (!reactor->finished_fired_) {
-            reactor->finished_.set_exception(std::current_exception());
+        failed_ = true;
+        if (!finished_fired_.exchange(true)) {
+            finished_.set_exception(std::current_exception());
         } else {
-            // Just let the world burn, we are already done here
-            throw;
+            lerror("Reactor::run(): exception after session finished, ignoring\n");
         }
     }
-    return 0;
-}
-
-void Reactor::shutdown_(void* arg) {
-    Reactor* reactor = static_cast<Reactor*>(arg);
-    assert(reactor != nullptr);
-    linfo("Reactor::shutdown_(): stopping processing on Jack shutdown\n");
-    reactor->signal_finished();
-}
-
-void Reactor::signal_handler_(int sig) {
-    assert(instance != nullptr);
-    linfo("Reactor::signal_handler_(): stopping on signal %d\n", sig);
-    instance->signal_finished();
-}
 }
+}
\ No newline at end of file
@@ -1,15 +1,46 @@
 #pragma once
 #include "types.hpp"
+#include "xrun.hpp"
 
 #include <jack/jack.h>
 
 #include <exception>
 #include <future>
+#include <atomic>
 
 namespace olo {
 
+// When playback & capture start; unless set, they start on first process cycle.
+struct StartCondition {
+    // Absolute Jack frame time (jack_frame_time()) of the first frame processed
+    optional<jack_nframes_t> frame;
+    // Start on first cycle when Jack transport is rolling
+    bool transport = false;
+};
+
+// What setting up a session's ports took, in the order it's done.
+struct SessionSetup {
+    double validate_secs = 0;
+    // Registering or taking over ports from SessionManager's pool
+    double register_secs = 0;
+    double activate_secs = 0;
+    double connect_secs = 0;
+    double total_secs = 0;
+    size_t ports_registered = 0;
+    // Registered by SessionManager while other things were set up
+    size_t ports_preregistered = 0;
+    // Left over by a previous session
+    size_t ports_reused = 0;
+    size_t connections_made = 0;
+    // Already there on a reused port
+    size_t connections_reused = 0;
+};
+
+// Single play/record session on a set of client ports, run by SessionManager.
 class Reactor {
+    SessionManager& sessions_;
     JackClient& client_;
+    size_t id_;
     // Names of client-side Jack ports used for connecting
     vector<string> input_names_;
     vector<string> output_names_;
@@ -21,46 +52,99 @@ class Reactor {
     vector<const Sample*> input_buffers_;
     Reader* reader_ = nullptr;
     Writer* writer_ = nullptr;
+    ShmPublisher* publisher_ = nullptr;
+    XrunLog* xrun_log_ = nullptr;
+    RamRecorder* ram_ = nullptr;
+    SoakTest* soak_ = nullptr;
+    SpectrumAnalyzer* analyzer_ = nullptr;
+    // Keep recording aligned to Jack timeline by filling dropped frames with silence,
+    // and playback by skipping frames which weren't played in time.
+    bool preserve_timeline_ = false;
     size_t underruns_ = 0;
     size_t overruns_ = 0;
+    size_t xruns_ = 0;
+    // Number of frames put into writer's ringbuffer so far
+    size_t captured_ = 0;
+    // Number of playback frames which were due while ringbuffer was empty, to be skipped
+    size_t playback_debt_ = 0;
+    // Jack frame time of first frame processed in current cycle
+    jack_nframes_t cycle_frame_ = 0;
+    // Jack frame time next cycle starts at, unless cycles get lost
+    jack_nframes_t next_cycle_frame_ = 0;
     // Total number of frames needed to process to consider RT thread work as finished
     size_t needed_ = 0;
+    // True if processing ends with the playback stream, whose length isn't known upfront
+    bool until_playback_end_ = false;
+    StartCondition start_;
+    // Set from RT thread once the start condition is met
+    bool started_ = false;
+    optional<jack_nframes_t> start_frame_;
+    // Jack time (jack_get_time()) of the cycle which first played frames from the reader
+    optional<jack_time_t> first_sample_time_;
     // Number of frames processed so far
     size_t done_ = 0;
     // Protects `finished_` from being signalled multiple times which has catastrophical results.
-    bool finished_fired_ = false;
+    std::atomic<bool> finished_fired_{false};
     // Delivers signal that RT thread is finished to the control thread
     std::promise<void> finished_;
-    // True if jack_activate() succeded and needs to be paired with jack_deactivate()
-    bool activated_ = false;
+    // Set when processing threw, session only mutes its outputs afterwards
+    bool failed_ = false;
+    SessionSetup setup_;
 
+    void validate_ports(const vector<string>& input_ports, const vector<string>& output_ports) const;
     void register_ports(const vector<string>& input_ports, const vector<string>& output_ports);
     void connect_ports(const vector<string>& input_ports, const vector<string>& output_ports);
-
-    static int process_(jack_nframes_t frame_count, void* arg);
-    static void shutdown_(void* arg);
-    static void signal_handler_(int sig);
+    void connect_port(jack_port_t* port, const string& peer, const string& source, const string& destination);
+    bool keep_connection(jack_port_t* port, const string& peer);
+    void release_ports();
 
     void process(size_t frame_count);
-    void deactivate();
-    void activate();
     void signal_finished();
-    void playback(size_t frame_count);
-    void capture(size_t frame_count);
+    bool try_start(size_t frame_count, size_t& offset);
+    void mute(size_t frame_count);
+    void playback(size_t offset, size_t frame_count);
+    void capture(size_t offset, size_t frame_count);
+    void write_capture(size_t frame_count);
+    void soak(size_t offset, size_t frame_count);
+    void check_timeline(jack_nframes_t cycle_start);
+    void report_xrun(XrunCause cause, size_t frame, jack_nframes_t jack_frame, size_t frame_count);
+    bool capturing() const {
+        return writer_ != nullptr || publisher_ != nullptr || ram_ != nullptr || soak_ != nullptr || analyzer_ != nullptr;
+    }
+    bool playing() const { return reader_ != nullptr || soak_ != nullptr; }
 
 public:
     explicit Reactor(
-        JackClient& client,
+        SessionManager& sessions,
         const vector<string>& input_ports,
         const vector<string>& output_ports,
         Reader* reader = nullptr,
         Writer* writer = nullptr,
-        bool duration_infinite = false
+        ShmPublisher* publisher = nullptr,
+        bool duration_infinite = false,
+        const StartCondition& start = {},
+        bool preserve_timeline = false,
+        XrunLog* xrun_log = nullptr,
+        RamRecorder* ram = nullptr,
+        SoakTest* soak = nullptr,
+        SpectrumAnalyzer* analyzer = nullptr
     );
 
     ~Reactor();
 
+    // Called by SessionManager from RT thread on every process cycle.
+    void run(size_t frame_count);
+    // Requests the session to finish, as if it was done processing.
+    void stop() { signal_finished(); }
     void wait_finished();
+    // Jack frame time playback & capture started at, unset if they never did.
+    optional<jack_nframes_t> start_frame() const { return start_frame_; }
+    // Jack time the first playback frame went out at, unset if none did.
+    optional<jack_time_t> first_sample_time() const { return first_sample_time_; }
+    const SessionSetup& setup() const { return setup_; }
+    size_t overruns() const { return overruns_; }
+    size_t underruns() const { return underruns_; }
+    size_t xruns() const { return xruns_; }
 };
 
 }
\ No newline at end of file
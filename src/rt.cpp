@@ -0,0 +1,139 @@
+#include "rt.hpp"
+#include "log.hpp"
+
+#include <boost/format.hpp>
+
+#include <cstring>
+#include <cerrno>
+
+#ifndef _WIN32
+# include <sys/mman.h>
+# include <pthread.h>
+# include <sched.h>
+# include <unistd.h>
+#endif
+#ifdef __GLIBC__
+# include <malloc.h>
+#endif
+
+namespace olo {
+using boost::format;
+
+namespace {
+#ifndef _WIN32
+size_t page_size() {
+    static const size_t res = sysconf(_SC_PAGESIZE);
+    return res;
+}
+
+// Reads one byte per page. Called on locked regions only, which are resident
+// already, it makes sure they are mapped into the process' page tables too.
+void touch_pages(const void* addr, size_t size) {
+    auto p = static_cast<const volatile char*>(addr);
+    for (size_t off = 0; off < size; off += page_size()) {
+        (void)p[off];
+    }
+}
+#endif
+}
+
+void RtSetup::fail(const string& what, int err) {
+    failures_.push_back(err != 0 ? what + ": " + std::strerror(err) : what);
+}
+
+void RtSetup::lock_memory() {
+#ifdef _WIN32
+    fail("locking process memory is not supported on this platform", 0);
+#else
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        fail("locking process memory (check RLIMIT_MEMLOCK, e.g. ulimit -l)", errno);
+    } else {
+        ldebug("RtSetup::lock_memory(): process memory locked\n");
+        ++applied_;
+    }
+# ifdef __GLIBC__
+    // Freed memory stays mapped & locked, allocations don't map new pages
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+# endif
+#endif
+}
+
+void RtSetup::lock_buffer(jack_ringbuffer_t* ring, const string& name) {
+    if (0 != jack_ringbuffer_mlock(ring)) {
+        fail(str(format("locking %1% ringbuffer of %2% bytes") % name % ring->size), errno);
+        return;
+    }
+#ifndef _WIN32
+    touch_pages(ring->buf, ring->size);
+#endif
+    ldebug("RtSetup::lock_buffer(): %s ringbuffer locked\n", name.c_str());
+    ++applied_;
+}
+
+void RtSetup::lock_region(const void* addr, size_t size, const string& name) {
+#ifdef _WIN32
+    fail(str(format("locking %1% memory is not supported on this platform") % name), 0);
+#else
+    if (mlock(addr, size) != 0) {
+        fail(str(format("locking %1% memory of %2% bytes") % name % size), errno);
+        return;
+    }
+    touch_pages(addr, size);
+    ldebug("RtSetup::lock_region(): %s memory locked\n", name.c_str());
+    ++applied_;
+#endif
+}
+
+void RtSetup::schedule(std::thread& thread, const ThreadSchedule& schedule, const string& name) {
+#ifdef _WIN32
+    if (schedule.priority || !schedule.cpus.empty()) {
+        fail(str(format("scheduling %1% thread is not supported on this platform") % name), 0);
+    }
+#else
+    if (schedule.priority) {
+        int policy = policy_ == RtPolicy::RR ? SCHED_RR : SCHED_FIFO;
+        sched_param param = {0};
+        param.sched_priority = *schedule.priority;
+        int err = pthread_setschedparam(thread.native_handle(), policy, &param);
+        if (0 != err) {
+            fail(str(format("setting %1% thread to %2% priority %3% (check RLIMIT_RTPRIO)")
+                % name % (policy == SCHED_RR ? "SCHED_RR" : "SCHED_FIFO") % *schedule.priority), err);
+        } else {
+            ldebug("RtSetup::schedule(): %s thread priority set to %d\n", name.c_str(), *schedule.priority);
+            ++applied_;
+        }
+    }
+    if (!schedule.cpus.empty()) {
+# ifdef __linux__
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        for (int cpu: schedule.cpus) {
+            CPU_SET(cpu, &cpus);
+        }
+        int err = pthread_setaffinity_np(thread.native_handle(), sizeof(cpus), &cpus);
+        if (0 != err) {
+            fail(str(format("setting %1% thread CPU affinity") % name), err);
+        } else {
+            ldebug("RtSetup::schedule(): %s thread CPU affinity set\n", name.c_str());
+            ++applied_;
+        }
+# else
+        fail(str(format("setting %1% thread CPU affinity is not supported on this platform") % name), 0);
+# endif
+    }
+#endif
+}
+
+void RtSetup::report() const {
+    for (auto& failure: failures_) {
+        lerror("RtSetup: could not apply: %s\n", failure.c_str());
+    }
+    if (failures_.empty()) {
+        linfo("RtSetup: all %zd real-time settings applied\n", applied_);
+    } else {
+        linfo("RtSetup: %zd real-time settings applied, %zd failed\n", applied_, failures_.size());
+    }
+}
+
+}
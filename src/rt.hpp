@@ -0,0 +1,47 @@
+#pragma once
+#include "types.hpp"
+
+#include <jack/ringbuffer.h>
+
+#include <thread>
+
+namespace olo {
+
+enum class RtPolicy {
+    FIFO,
+    RR
+};
+
+// Scheduling of a worker thread; unset priority or empty cpu list leaves it as is.
+struct ThreadSchedule {
+    optional<int> priority;
+    vector<int> cpus;
+};
+
+// Applies real-time hardening (--rt) before the Reactor is activated. Every
+// step is applied on best-effort basis, failures are collected for report()
+// instead of thrown, as partial hardening is still better than none.
+class RtSetup {
+    RtPolicy policy_;
+    vector<string> failures_;
+    size_t applied_ = 0;
+
+    void fail(const string& what, int err);
+
+public:
+    explicit RtSetup(RtPolicy policy = RtPolicy::FIFO): policy_{policy} {}
+
+    // Locks current and future process memory and keeps the allocator from
+    // returning memory to the OS, so no page faults happen in the RT path.
+    void lock_memory();
+    // Locks and prefaults a ringbuffer shared with the RT thread.
+    void lock_buffer(jack_ringbuffer_t* ring, const string& name);
+    // Locks and prefaults an arbitrary memory region used by the RT thread.
+    void lock_region(const void* addr, size_t size, const string& name);
+    void schedule(std::thread& thread, const ThreadSchedule& schedule, const string& name);
+
+    const vector<string>& failures() const { return failures_; }
+    void report() const;
+};
+
+}
@@ -0,0 +1,324 @@
+#include "session.hpp"
+#include "jack_client.hpp"
+#include "reactor.hpp"
+#include "log.hpp"
+
+#include <boost/format.hpp>
+
+#include <stdexcept>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <csignal>
+#include <cstring>
+#include <cassert>
+
+namespace olo {
+using std::runtime_error;
+using std::signal;
+using boost::format;
+
+namespace {
+const int SIGNALS_INTERCEPT[] = {
+    SIGINT,
+    SIGTERM,
+#ifdef SIGQUIT
+    SIGQUIT,
+#endif
+#ifdef SIGHUP
+    SIGHUP,
+#endif
+};
+
+// Set by signal handler, picked up by the RT thread; lock-free so that it's safe to use in signal handler
+std::atomic<int> signal_caught{0};
+
+// Jack server which doesn't finish a cycle in this time gets the client deactivated
+const auto CYCLE_WAIT_MAX = std::chrono::seconds(1);
+
+const size_t NO_IDLE_SLOT = static_cast<size_t>(-1);
+
+jack_port_t* register_port(JackClient& client, const string& name, bool input) {
+    return jack_port_register(client.handle(), name.c_str(), JACK_DEFAULT_AUDIO_TYPE,
+        input ? JackPortIsInput : JackPortIsOutput, 0);
+}
+}
+
+const size_t SessionManager::SESSIONS_MAX;
+const size_t SessionManager::IDLE_OUTPUTS_MAX;
+
+SessionManager::SessionManager(JackClient& client, bool reuse_ports, bool keep_ports_on_exit):
+    client_{client},
+    reuse_ports_{reuse_ports},
+    keep_ports_on_exit_{keep_ports_on_exit}
+{
+    for (auto& session: sessions_) {
+        session = nullptr;
+    }
+    for (auto& port: idle_outputs_) {
+        port = nullptr;
+    }
+    int err;
+    if (0 != (err = jack_set_process_callback(client_.handle(), process_, this)))  {
+        throw runtime_error{str(format("failed setting Jack process callback with error %1%") % err)};
+    }
+    jack_on_shutdown(client_.handle(), shutdown_, this);
+}
+
+SessionManager::~SessionManager() {
+    if (preregister_thread_) {
+        preregister_thread_->join();
+    }
+    deactivate();
+}
+
+void SessionManager::activate() {
+    assert(!activated_);
+    int err;
+    if (0 != (err = jack_activate(client_.handle()))) {
+        throw runtime_error{str(format("failed activating Jack client with error %1%") % err)};
+    } else {
+        ldebug("SessionManager::activate(): Jack client activated\n");
+        activated_ = true;
+    }
+    // Only intercepted while someone picks them up
+    for (int sig: SIGNALS_INTERCEPT) {
+        signal(sig, signal_handler_);
+    }
+}
+
+void SessionManager::deactivate() {
+    if (activated_) {
+        jack_deactivate(client_.handle());
+        ldebug("SessionManager::deactivate(): Jack client deactivated\n");
+        activated_ = false;
+        // Restore original signal handlers
+        for (int sig: SIGNALS_INTERCEPT) {
+            signal(sig, SIG_DFL);
+        }
+    }
+}
+
+void SessionManager::ensure_active() {
+    std::lock_guard<std::mutex> lock{mx_};
+    if (!activated_) {
+        activate();
+    }
+}
+
+string SessionManager::port_name(size_t session_id, bool input, size_t index) {
+    // Keeps port names of concurrent sessions apart, plain for the first one
+    const string prefix = session_id == 1 ? "" : str(format("session%1%_") % session_id);
+    return str(format("%1%%2%_%3%") % prefix % (input ? "input" : "output") % index);
+}
+
+void SessionManager::preregister_ports(const vector<string>& input_ports, const vector<string>& output_ports) {
+    std::lock_guard<std::mutex> lock{mx_};
+    join_preregister();
+    preregister_thread_.reset(new std::thread([this, input_ports, output_ports] {
+        const auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i != input_ports.size() + output_ports.size(); ++i) {
+            const bool input = i < input_ports.size();
+            const size_t index = input ? i : i - input_ports.size();
+            if (!input && NULL_OUTPUT == output_ports[index]) {
+                continue;
+            }
+            const auto name = port_name(1, input, index);
+            auto port = register_port(client_, name, input);
+            if (!port) {
+                // The session registers it again, and reports failure if there is one
+                ldebug("SessionManager::preregister_ports(): failed registering port %s, giving up\n", name.c_str());
+                return;
+            }
+            preregistered_.push_back({port, input, true, true, NO_IDLE_SLOT});
+        }
+        ldebug("SessionManager::preregister_ports(): %zd ports registered in %.1f ms\n", preregistered_.size(),
+            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }));
+}
+
+void SessionManager::join_preregister() {
+    if (preregister_thread_) {
+        preregister_thread_->join();
+        preregister_thread_.reset();
+        pool_.insert(pool_.end(), preregistered_.begin(), preregistered_.end());
+        preregistered_.clear();
+    }
+}
+
+jack_port_t* SessionManager::acquire_port(const string& name, bool input, const string& peer, PortOrigin& origin) {
+    std::lock_guard<std::mutex> lock{mx_};
+    join_preregister();
+    const string full_name = string{client_.name()} + ":" + name;
+    auto find = [&](auto match) {
+        return std::find_if(pool_.begin(), pool_.end(), [&](const PooledPort& p) {
+            return p.reusable && p.input == input && match(p.port);
+        });
+    };
+    // A port still connected to the peer saves the connection round trip
+    auto it = pool_.end();
+    if (!peer.empty()) {
+        it = find([&](jack_port_t* port) { return jack_port_connected_to(port, peer.c_str()) != 0; });
+    }
+    if (it == pool_.end()) {
+        it = find([&](jack_port_t* port) { return full_name == jack_port_name(port); });
+    }
+    if (it == pool_.end()) {
+        it = find([](jack_port_t*) { return true; });
+    }
+    if (it != pool_.end()) {
+        auto pooled = *it;
+        pool_.erase(it);
+        if (pooled.idle_slot != NO_IDLE_SLOT) {
+            // Session isn't added yet, so nothing else writes the port until it is
+            idle_outputs_[pooled.idle_slot].store(nullptr);
+        }
+        origin = pooled.preregistered ? PortOrigin::PREREGISTERED : PortOrigin::REUSED;
+        return pooled.port;
+    }
+    // Name may be held by a pooled port another session took in its stead
+    string unique_name = name;
+    for (size_t n = 2; jack_port_by_name(client_.handle(), (string{client_.name()} + ":" + unique_name).c_str()); ++n) {
+        unique_name = str(format("%1%_%2%") % name % n);
+    }
+    auto port = register_port(client_, unique_name, input);
+    if (!port) {
+        throw runtime_error{str(format("failed creating port %1%") % unique_name)};
+    }
+    origin = PortOrigin::REGISTERED;
+    return port;
+}
+
+void SessionManager::release_port(jack_port_t* port, bool input) {
+    std::lock_guard<std::mutex> lock{mx_};
+    if (reuse_ports_ || keep_ports_on_exit_) {
+        if (input) {
+            pool_.push_back({port, input, false, reuse_ports_, NO_IDLE_SLOT});
+            return;
+        }
+        // Outputs keep playing whatever their buffer has unless RT thread mutes them
+        for (size_t slot = 0; slot != IDLE_OUTPUTS_MAX; ++slot) {
+            if (idle_outputs_[slot].load() == nullptr) {
+                pool_.push_back({port, input, false, reuse_ports_, slot});
+                idle_outputs_[slot].store(port);
+                if (slot >= idle_outputs_used_.load()) {
+                    idle_outputs_used_.store(slot + 1);
+                }
+                return;
+            }
+        }
+    }
+    // Jack drops connections of the port along with it
+    jack_port_unregister(client_.handle(), port);
+}
+
+void SessionManager::add(Reactor* session) {
+    std::lock_guard<std::mutex> lock{mx_};
+    for (auto& slot: sessions_) {
+        if (slot.load() == nullptr) {
+            slot.store(session);
+            if (!activated_) {
+                try {
+                    activate();
+                } catch (...) {
+                    slot.store(nullptr);
+                    throw;
+                }
+            }
+            return;
+        }
+    }
+    throw runtime_error{str(format("too many concurrent sessions, at most %1% supported") % SESSIONS_MAX)};
+}
+
+void SessionManager::remove(Reactor* session) {
+    std::lock_guard<std::mutex> lock{mx_};
+    for (auto& slot: sessions_) {
+        if (slot.load() == session) {
+            slot.store(nullptr);
+            wait_cycle();
+            return;
+        }
+    }
+}
+
+void SessionManager::wait_cycle() {
+    auto seq = cycle_seq_.load();
+    if (!activated_ || seq % 2 == 0) {
+        return;
+    }
+    // RT thread is inside a cycle which may still see the removed session
+    auto deadline = std::chrono::steady_clock::now() + CYCLE_WAIT_MAX;
+    while (cycle_seq_.load() == seq && !shut_down_) {
+        if (std::chrono::steady_clock::now() >= deadline) {
+            // Session must not be used once we return, and after deactivation it can't be
+            lerror("SessionManager::wait_cycle(): Jack cycle doesn't finish, deactivating client\n");
+            deactivate();
+            return;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+}
+
+size_t SessionManager::stop_all() {
+    size_t stopped = 0;
+    for (auto& slot: sessions_) {
+        if (auto session = slot.load()) {
+            session->stop();
+            ++stopped;
+        }
+    }
+    return stopped;
+}
+
+int SessionManager::take_signal() {
+    return signal_caught.exchange(0);
+}
+
+void SessionManager::process(jack_nframes_t frame_count) {
+    int sig = signal_caught.load();
+    // Signal stays pending until there's a session to stop
+    if (sig != 0 && stop_all() != 0 && signal_caught.compare_exchange_strong(sig, 0)) {
+        linfo("SessionManager::process(): stopping on signal %d\n", sig);
+    }
+    mute_idle(frame_count);
+    for (auto& slot: sessions_) {
+        if (auto session = slot.load()) {
+            session->run(frame_count);
+        }
+    }
+}
+
+void SessionManager::mute_idle(jack_nframes_t frame_count) {
+    const size_t used = idle_outputs_used_.load();
+    for (size_t slot = 0; slot != used; ++slot) {
+        if (auto port = idle_outputs_[slot].load()) {
+            if (auto buff = jack_port_get_buffer(port, frame_count)) {
+                std::memset(buff, 0, sizeof(Sample) * frame_count);
+            }
+        }
+    }
+}
+
+int SessionManager::process_(jack_nframes_t frame_count, void* arg) {
+    auto manager = static_cast<SessionManager*>(arg);
+    assert(manager != nullptr);
+    manager->cycle_seq_.fetch_add(1);
+    manager->process(frame_count);
+    manager->cycle_seq_.fetch_add(1);
+    return 0;
+}
+
+void SessionManager::shutdown_(void* arg) {
+    auto manager = static_cast<SessionManager*>(arg);
+    assert(manager != nullptr);
+    linfo("SessionManager::shutdown_(): stopping processing on Jack shutdown\n");
+    manager->shut_down_ = true;
+    manager->stop_all();
+}
+
+void SessionManager::signal_handler_(int sig) {
+    signal_caught.store(sig);
+}
+
+}
@@ -0,0 +1,127 @@
+#pragma once
+#include "types.hpp"
+
+#include <jack/jack.h>
+
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <thread>
+
+namespace olo {
+
+class Reactor;
+
+// Runs any number of Reactor sessions on a single Jack client. Owns the
+// client's process & shutdown callbacks and its activation, and handles
+// termination signals for the whole process: each process cycle calls every
+// registered session in turn. Sessions are added and removed from control
+// threads while the client keeps running.
+//
+// Also keeps a pool of client ports, so that sessions don't have to register
+// each of their ports one round trip to the Jack server at a time: ports can be
+// registered ahead on a background thread while playback is being prefilled, and
+// in reuse mode ports of a finished session stay registered and connected for
+// the next one. Pooled ports are only unregistered when the client is closed.
+// Ports of a process' last session can be left for the client close too, which
+// saves unregistering them one by one on exit.
+class SessionManager {
+public:
+    static const size_t SESSIONS_MAX = 16;
+    // Output ports kept in the pool, muted by the RT thread while idle
+    static const size_t IDLE_OUTPUTS_MAX = 1024;
+
+    // Where a port handed out to a session comes from
+    enum class PortOrigin {
+        REGISTERED,
+        PREREGISTERED,
+        REUSED,
+    };
+
+private:
+    struct PooledPort {
+        jack_port_t* port;
+        bool input;
+        bool preregistered;
+        // False if only kept registered until the client closes, never handed out again
+        bool reusable;
+        // Slot in idle_outputs_ for output ports
+        size_t idle_slot;
+    };
+
+    JackClient& client_;
+    bool reuse_ports_;
+    bool keep_ports_on_exit_;
+    // Slots scanned by the RT thread, null if free
+    std::atomic<Reactor*> sessions_[SESSIONS_MAX];
+    // Pooled output ports, whose buffers RT thread clears, null if free
+    std::atomic<jack_port_t*> idle_outputs_[IDLE_OUTPUTS_MAX];
+    // Number of idle_outputs_ slots RT thread scans, only ever grows
+    std::atomic<size_t> idle_outputs_used_{0};
+    // Incremented by RT thread on entry to and exit from process callback,
+    // so it's odd while a cycle is running.
+    std::atomic<unsigned long> cycle_seq_{0};
+    // Set once Jack shut the client down and won't call it anymore
+    std::atomic<bool> shut_down_{false};
+    // Serializes add() & remove(), and access to the port pool
+    std::mutex mx_;
+    bool activated_ = false;
+    std::atomic<size_t> last_id_{0};
+    vector<PooledPort> pool_;
+    // Ports registered by preregister_thread_, moved to the pool once it's joined
+    vector<PooledPort> preregistered_;
+    std::unique_ptr<std::thread> preregister_thread_;
+
+    static int process_(jack_nframes_t frame_count, void* arg);
+    static void shutdown_(void* arg);
+    static void signal_handler_(int sig);
+
+    void process(jack_nframes_t frame_count);
+    size_t stop_all();
+    void activate();
+    void deactivate();
+    void wait_cycle();
+    void join_preregister();
+    void mute_idle(jack_nframes_t frame_count);
+
+public:
+    // With `reuse_ports`, ports released by sessions go back to the pool instead of
+    // being unregistered. With `keep_ports_on_exit` they stay registered, muted,
+    // until the client is closed, for processes which close it right after their
+    // last session.
+    explicit SessionManager(JackClient& client, bool reuse_ports = false, bool keep_ports_on_exit = false);
+    ~SessionManager();
+
+    SessionManager(const SessionManager&) = delete;
+    SessionManager& operator=(const SessionManager&) = delete;
+
+    JackClient& client() const { return client_; }
+    // Unique id for a new session, starting from 1.
+    size_t next_id() { return ++last_id_; }
+    // Short name of a session's client port, e.g. input_0 or session2_output_1.
+    static string port_name(size_t session_id, bool input, size_t index);
+
+    // Starts registering ports for the first session on a background thread, for
+    // each of the given ports it's going to connect to.
+    void preregister_ports(const vector<string>& input_ports, const vector<string>& output_ports);
+    // Hands out a client port for a session, preferring a pooled one connected to
+    // `peer`, then one named `name`, then any of the same direction; registers a new
+    // one if the pool has none. Reused ports keep the names they were registered with.
+    jack_port_t* acquire_port(const string& name, bool input, const string& peer, PortOrigin& origin);
+    // Returns port of a removed session to the pool in reuse mode, keeps it registered
+    // with `keep_ports_on_exit`, unregisters it otherwise.
+    void release_port(jack_port_t* port, bool input);
+    // Activates the client unless it already is, so that ports can be connected
+    // before the session is added.
+    void ensure_active();
+    // Starts calling the session from RT thread, activating the client if needed.
+    void add(Reactor* session);
+    // Stops calling the session; when this returns the RT thread is done with it.
+    void remove(Reactor* session);
+    // Termination signal caught and not yet acted upon, cleared by the call; 0 if none.
+    // RT thread stops running sessions on it, but sessions which aren't run, or
+    // aren't added yet, have to poll it.
+    static int take_signal();
+};
+
+}
@@ -0,0 +1,180 @@
+#include "shm.hpp"
+#include "log.hpp"
+
+#include <boost/format.hpp>
+
+#include <stdexcept>
+#include <atomic>
+#include <cstring>
+#include <cassert>
+#include <cerrno>
+
+#ifndef _WIN32
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <fcntl.h>
+# include <unistd.h>
+#endif
+
+namespace olo {
+using std::runtime_error;
+using boost::format;
+
+namespace {
+size_t next_pow2(size_t n) {
+    size_t res = 1;
+    while (res < n) {
+        res <<= 1;
+    }
+    return res;
+}
+
+// Smallest Jack period is 16 frames, so the block table always covers the whole sample ring.
+const size_t FRAMES_PER_BLOCK_MIN = 16;
+
+size_t align_up(size_t n, size_t a) {
+    return (n + a - 1) / a * a;
+}
+
+// Readers live in other processes, only plain stores ordered by a fence are portable there
+template<typename T, typename V>
+void store_release(T& dst, V value) {
+    std::atomic_thread_fence(std::memory_order_release);
+    *static_cast<volatile T*>(&dst) = value;
+}
+}
+
+ShmPublisher::ShmPublisher(
+    const string& name,
+    size_t sample_rate,
+    size_t channel_count,
+    double ring_secs,
+    double duration_secs
+):
+    name_{name[0] == '/' ? name : "/" + name},
+    sample_rate_{sample_rate},
+    channel_count_{channel_count}
+{
+#ifdef _WIN32
+    throw runtime_error{"shared memory streaming is not supported on this platform"};
+#else
+    size_t capacity = next_pow2(std::max<size_t>(ring_secs * sample_rate_ + .5, 1));
+    size_t block_capacity = next_pow2(std::max<size_t>(capacity / FRAMES_PER_BLOCK_MIN, 1));
+    size_t blocks_offset = align_up(sizeof(arrow1_shm_header), 64);
+    size_t data_offset = align_up(blocks_offset + block_capacity * sizeof(arrow1_shm_block), 64);
+    segment_size_ = data_offset + capacity * channel_count_ * sizeof(Sample);
+
+    // Readers still mapping a segment of the same name keep it, instead of faulting on a truncated one
+    if (shm_unlink(name_.c_str()) == 0) {
+        linfo("ShmPublisher: replacing existing shared memory segment %s\n", name_.c_str());
+    }
+    int fd = shm_open(name_.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        throw runtime_error{str(format("can't create shared memory segment %1%: %2%")
+            % name_ % std::strerror(errno))};
+    }
+    if (ftruncate(fd, segment_size_) != 0) {
+        int err = errno;
+        ::close(fd);
+        shm_unlink(name_.c_str());
+        throw runtime_error{str(format("can't resize shared memory segment %1% to %2% bytes: %3%")
+            % name_ % segment_size_ % std::strerror(err))};
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0) {
+        segment_dev_ = st.st_dev;
+        segment_ino_ = st.st_ino;
+    }
+    segment_ = mmap(nullptr, segment_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    int err = errno;
+    ::close(fd);
+    if (segment_ == MAP_FAILED) {
+        segment_ = nullptr;
+        shm_unlink(name_.c_str());
+        throw runtime_error{str(format("can't map shared memory segment %1%: %2%")
+            % name_ % std::strerror(err))};
+    }
+    // Touch all the pages now so that RT thread doesn't fault on them
+    std::memset(segment_, 0, segment_size_);
+
+    auto base = static_cast<char*>(segment_);
+    header_ = reinterpret_cast<arrow1_shm_header*>(base);
+    blocks_ = reinterpret_cast<arrow1_shm_block*>(base + blocks_offset);
+    data_ = reinterpret_cast<Sample*>(base + data_offset);
+
+    header_->version = ARROW1_SHM_VERSION;
+    header_->channels = channel_count_;
+    header_->sample_rate = sample_rate_;
+    header_->capacity = capacity;
+    header_->block_capacity = block_capacity;
+    header_->state = ARROW1_SHM_RUNNING;
+    header_->blocks_offset = blocks_offset;
+    header_->data_offset = data_offset;
+    // Magic goes last, so that readers attaching early don't see half-initialized header
+    store_release(header_->magic, ARROW1_SHM_MAGIC);
+
+    needed_ = duration_secs * sample_rate_ + .5;
+    ldebug("ShmPublisher: publishing to %s with %zd sample rate, %zd channels and %zd frames ring\n",
+        name_.c_str(), sample_rate_, channel_count_, capacity);
+#endif
+}
+
+ShmPublisher::~ShmPublisher() {
+#ifndef _WIN32
+    close();
+    if (segment_ != nullptr) {
+        munmap(segment_, segment_size_);
+    }
+#endif
+}
+
+void ShmPublisher::close() {
+#ifndef _WIN32
+    if (header_ == nullptr || header_->state == ARROW1_SHM_FINISHED) {
+        return;
+    }
+    store_release(header_->state, ARROW1_SHM_FINISHED);
+    // Another publisher may have taken over the name meanwhile, leave its segment alone
+    int fd = shm_open(name_.c_str(), O_RDONLY, 0);
+    if (fd >= 0) {
+        struct stat st;
+        const bool ours = fstat(fd, &st) == 0 && st.st_dev == segment_dev_ && st.st_ino == segment_ino_;
+        ::close(fd);
+        if (ours) {
+            shm_unlink(name_.c_str());
+        }
+    }
+    ldebug("ShmPublisher::close(): published %zd frames to %s\n", done_, name_.c_str());
+#endif
+}
+
+void ShmPublisher::publish(const Sample* const* channels, size_t frame_count,
+    jack_nframes_t jack_frame, jack_time_t usecs)
+{
+    if (finished()) {
+        return;
+    }
+    if (needed_ != 0) {
+        assert(done_ <= needed_);
+        frame_count = std::min(frame_count, needed_ - done_);
+    }
+    const size_t mask = header_->capacity - 1;
+    for (size_t n = 0; n != frame_count; ++n) {
+        Sample* frame = &data_[((done_ + n) & mask) * channel_count_];
+        for (size_t c = 0; c != channel_count_; ++c) {
+            frame[c] = channels[c][n];
+        }
+    }
+    auto& block = blocks_[blocks_done_ & (header_->block_capacity - 1)];
+    block.frame_index = done_;
+    block.usecs = usecs;
+    block.jack_frame = jack_frame;
+    block.frame_count = frame_count;
+    done_ += frame_count;
+    ++blocks_done_;
+    // Samples and block entry above must be visible before the indices
+    store_release(header_->block_index, blocks_done_);
+    store_release(header_->write_index, done_);
+}
+
+}
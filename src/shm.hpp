@@ -0,0 +1,60 @@
+#pragma once
+#include "types.hpp"
+#include "arrow1_shm.h"
+
+#include <jack/jack.h>
+
+namespace olo {
+
+// Publishes captured frames into a named POSIX shared memory ring so that
+// local processes can watch the capture live. Layout and reader protocol are
+// described in arrow1_shm.h. Written to directly from the RT thread, all the
+// memory is allocated and touched upfront.
+class ShmPublisher {
+    string name_;
+    size_t sample_rate_;
+    size_t channel_count_;
+    size_t segment_size_ = 0;
+    void* segment_ = nullptr;
+    // Identity of the segment created, so that close() never unlinks one which replaced it
+    unsigned long long segment_dev_ = 0;
+    unsigned long long segment_ino_ = 0;
+    arrow1_shm_header* header_ = nullptr;
+    arrow1_shm_block* blocks_ = nullptr;
+    Sample* data_ = nullptr;
+    // Publish at most needed_ frames, 0 means no limit.
+    size_t needed_ = 0;
+    // Number of frames published so far, mirrors header_->write_index.
+    size_t done_ = 0;
+    size_t blocks_done_ = 0;
+
+public:
+    explicit ShmPublisher(
+        const string& name,
+        size_t sample_rate,
+        size_t channel_count,
+        double ring_secs,
+        double duration_secs = 0.
+    );
+    ~ShmPublisher();
+
+    ShmPublisher(const ShmPublisher&) = delete;
+    ShmPublisher& operator=(const ShmPublisher&) = delete;
+
+    const string& name() const { return name_; }
+    size_t channel_count() const { return channel_count_; }
+    size_t sample_rate() const { return sample_rate_; }
+    size_t frames_needed() const { return needed_; }
+    size_t frames_done() const { return done_; }
+    bool finished() const { return needed_ != 0 && done_ == needed_; }
+    const void* segment() const { return segment_; }
+    size_t segment_size() const { return segment_size_; }
+
+    // Called from RT thread with per-channel buffers of `frame_count` samples.
+    void publish(const Sample* const* channels, size_t frame_count,
+        jack_nframes_t jack_frame, jack_time_t usecs);
+    // Marks the stream as finished for the readers and unlinks the segment name.
+    void close();
+};
+
+}
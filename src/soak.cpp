@@ -0,0 +1,172 @@
+#include "soak.hpp"
+#include "log.hpp"
+
+#include <boost/format.hpp>
+
+#include <stdexcept>
+#include <algorithm>
+#include <cstdint>
+
+namespace olo {
+using std::runtime_error;
+using boost::format;
+
+namespace {
+// Sample code is 1 + frame index (low bits) and channel number (lowest bits), scaled so that
+// every code is an exact float below 0.5 and survives the float path bit for bit.
+const size_t CHANNEL_BITS = 4;
+const size_t INDEX_BITS = 19;
+const uint32_t CHANNEL_MASK = (1u << CHANNEL_BITS) - 1;
+const uint32_t INDEX_MASK = (1u << INDEX_BITS) - 1;
+const uint32_t CODE_MAX = 1u << (INDEX_BITS + CHANNEL_BITS);
+const float CODE_SCALE = 1.f / (1u << 24);
+const Sample SILENCE = 0.f;
+// Frames verified at once
+const size_t CHUNK_FRAMES = 1024;
+
+inline Sample encode(size_t index, uint32_t channel) {
+    const uint32_t code = ((static_cast<uint32_t>(index) & INDEX_MASK) << CHANNEL_BITS | channel) + 1;
+    return static_cast<Sample>(code) * CODE_SCALE;
+}
+
+// Returns code less one, or -1 if sample doesn't carry a valid one.
+inline long decode(Sample sample) {
+    const float scaled = sample / CODE_SCALE;
+    const long code = static_cast<long>(scaled);
+    if (code < 1 || code > static_cast<long>(CODE_MAX) || static_cast<float>(code) != scaled) {
+        return -1;
+    }
+    return code - 1;
+}
+}
+
+SoakTest::SoakTest(
+    jack_client_t* client,
+    size_t sample_rate,
+    size_t channel_count,
+    size_t buffer_size,
+    double duration_secs,
+    bool self_loopback
+):
+    IoWorker{sample_rate, channel_count, buffer_size},
+    client_{client},
+    self_loopback_{self_loopback},
+    chunk_(CHUNK_FRAMES * channel_count),
+    load_countdown_{sample_rate}
+{
+    needed_ = duration_secs * sample_rate_ + .5;
+    ldebug("SoakTest: %zd channels through %s loopback, %zd frames\n",
+        channel_count_, self_loopback_ ? "own" : "external", needed_);
+    thread_.reset(new std::thread(&SoakTest::pump, this));
+}
+
+SoakTest::~SoakTest() {
+    stop();
+}
+
+void SoakTest::generate(Sample* const* channels, size_t frame_count) {
+    for (size_t c = 0; c != channel_count_; ++c) {
+        Sample* channel = channels[c];
+        const uint32_t id = c & CHANNEL_MASK;
+        for (size_t i = 0; i != frame_count; ++i) {
+            channel[i] = encode(generated_ + i, id);
+        }
+    }
+    generated_ += frame_count;
+}
+
+size_t SoakTest::capture(const Sample* const* channels, size_t frame_count) {
+    auto ring = buffer();
+    const size_t n = std::min(frame_count, jack_ringbuffer_write_space(ring) / frame_size_);
+    // Multiplex whole frames into ringbuffer
+    for (size_t i = 0; i != n; ++i) {
+        for (size_t c = 0; c != channel_count_; ++c) {
+            jack_ringbuffer_write(ring, reinterpret_cast<const char*>(&channels[c][i]), sizeof(Sample));
+        }
+    }
+    return n;
+}
+
+void SoakTest::verify(const Sample* frame) {
+    const size_t position = captured_++;
+    auto& r = report_;
+    if (std::all_of(frame, frame + channel_count_, [](Sample s) { return s == SILENCE; })) {
+        if (!r.latency) {
+            ++r.frames_silent;
+        } else {
+            // Signal went missing in the middle of the test
+            ++r.frames_corrupt;
+            ++expected_;
+        }
+        return;
+    }
+    const long code = decode(frame[0]);
+    bool valid = code >= 0 && (code & CHANNEL_MASK) == 0;
+    for (size_t c = 1; valid && c != channel_count_; ++c) {
+        valid = decode(frame[c]) == (code | static_cast<long>(c & CHANNEL_MASK));
+    }
+    if (!valid) {
+        ++r.frames_corrupt;
+        if (r.latency) {
+            ++expected_;
+        }
+        return;
+    }
+    const size_t index = code >> CHANNEL_BITS;
+    if (!r.latency) {
+        // Playback starts with index 0, so the first one captured is a full index
+        expected_ = index;
+        r.latency = r.latency_min = r.latency_max = static_cast<long>(position) - static_cast<long>(index);
+        ldebug("SoakTest::verify(): signal arrived after %ld frames of loopback latency\n", *r.latency);
+    } else {
+        // Distance from expected index, in range of half the index period either way
+        long delta = (index - expected_) & INDEX_MASK;
+        if (delta >= (1l << (INDEX_BITS - 1))) {
+            delta -= 1l << INDEX_BITS;
+        }
+        if (delta > 0) {
+            r.frames_dropped += delta;
+        } else if (delta < 0) {
+            r.frames_duplicated += -delta;
+        }
+        expected_ += delta;
+        const long latency = static_cast<long>(position) - static_cast<long>(expected_);
+        r.latency_min = std::min(r.latency_min, latency);
+        r.latency_max = std::max(r.latency_max, latency);
+    }
+    ++r.frames_verified;
+    ++expected_;
+}
+
+void SoakTest::sample_load() {
+    const float load = jack_cpu_load(client_);
+    ++report_.load_samples;
+    load_sum_ += load;
+    report_.load_max = std::max(report_.load_max, load);
+    report_.load_mean = load_sum_ / report_.load_samples;
+}
+
+void SoakTest::work_cycle() {
+    auto ring = buffer();
+    size_t readable = jack_ringbuffer_read_space(ring) / frame_size_;
+    while (readable != 0) {
+        const size_t count = std::min(readable, CHUNK_FRAMES);
+        jack_ringbuffer_read(ring, reinterpret_cast<char*>(chunk_.data()), count * frame_size_);
+        for (size_t i = 0; i != count; ++i) {
+            verify(&chunk_[i * channel_count_]);
+            if (--load_countdown_ == 0) {
+                sample_load();
+                load_countdown_ = sample_rate_;
+            }
+        }
+        readable -= count;
+    }
+    done_ = captured_;
+}
+
+void SoakTest::flush() {
+    work_cycle();
+    ldebug("SoakTest::flush(): %zd frames captured, %zd verified\n", captured_, report_.frames_verified);
+}
+
+}
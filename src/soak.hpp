@@ -0,0 +1,76 @@
+#pragma once
+#include "types.hpp"
+#include "io.hpp"
+
+#include <jack/jack.h>
+
+namespace olo {
+
+// Soak test of the whole play/capture path through a loopback. RT thread plays a
+// signal encoding frame index and channel number into every sample, and hands
+// captured frames to the worker thread, which decodes and verifies each of them.
+// Nothing is read from or written to disk.
+class SoakTest: public IoWorker {
+public:
+    struct Report {
+        size_t frames_verified = 0;
+        // Including frames which didn't fit into the ringbuffer, see Reactor overruns
+        size_t frames_dropped = 0;
+        size_t frames_duplicated = 0;
+        // Frames not carrying a valid code, or codes of other channels or frames
+        size_t frames_corrupt = 0;
+        // Frames captured before the signal arrived through the loopback
+        size_t frames_silent = 0;
+        // Loopback latency in frames, when the signal was first captured and its extremes since
+        optional<long> latency;
+        long latency_min = 0;
+        long latency_max = 0;
+        // Jack DSP load in percent, sampled once per second
+        size_t load_samples = 0;
+        float load_mean = 0.f;
+        float load_max = 0.f;
+    };
+
+private:
+    jack_client_t* client_;
+    bool self_loopback_;
+    // Frames generated by RT thread so far
+    size_t generated_ = 0;
+    // Frames taken from ringbuffer so far
+    size_t captured_ = 0;
+    vector<Sample> chunk_;
+    // Full frame index expected next
+    size_t expected_ = 0;
+    size_t load_countdown_;
+    float load_sum_ = 0.f;
+    Report report_;
+
+    void work_cycle() override;
+    void flush() override;
+    void verify(const Sample* frame);
+    void sample_load();
+
+public:
+    // `duration_secs` of 0 means until stopped; `self_loopback` connects own outputs to own inputs.
+    explicit SoakTest(
+        jack_client_t* client,
+        size_t sample_rate,
+        size_t channel_count,
+        size_t buffer_size,
+        double duration_secs,
+        bool self_loopback
+    );
+    ~SoakTest();
+
+    bool self_loopback() const { return self_loopback_; }
+    // Valid after stop().
+    const Report& report() const { return report_; }
+
+    // Called from RT thread: fills per-channel port buffers with the test signal.
+    void generate(Sample* const* channels, size_t frame_count);
+    // Called from RT thread: queues captured frames for verification and
+    // returns the number of frames which fit into the ringbuffer.
+    size_t capture(const Sample* const* channels, size_t frame_count);
+};
+
+}
@@ -0,0 +1,207 @@
+#include "spectrum.hpp"
+#include "log.hpp"
+
+#include <boost/format.hpp>
+
+#include <stdexcept>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+
+#ifdef __linux__
+# include <pthread.h>
+# include <sched.h>
+#endif
+
+namespace olo {
+using std::runtime_error;
+using boost::format;
+
+namespace {
+const double TWO_PI = 6.28318530717958647692;
+// Spectra are clamped to this level instead of going to -inf on digital silence
+const double DB_FLOOR = -200.;
+// Frames deinterleaved at once
+const size_t CHUNK_FRAMES = 1024;
+
+// Analysis must never compete with I/O threads, let it use spare CPU time only.
+void lower_priority(std::thread& thread) {
+#ifdef __linux__
+    sched_param param = {0};
+    int err = pthread_setschedparam(thread.native_handle(), SCHED_IDLE, &param);
+    if (err != 0) {
+        lerror("SpectrumAnalyzer: failed setting idle priority with error %d\n", err);
+    }
+#else
+    (void)thread;
+#endif
+}
+}
+
+SpectrumAnalyzer::Channel::Channel(size_t size):
+    fft{size},
+    history(size),
+    windowed(size),
+    re(fft.bins()),
+    im(fft.bins()),
+    power(fft.bins())
+{
+}
+
+SpectrumAnalyzer::SpectrumAnalyzer(
+    const string& path,
+    size_t sample_rate,
+    size_t channel_count,
+    size_t size,
+    double rate,
+    size_t thread_count,
+    double duration_secs
+):
+    // Ringbuffer holds a couple of segments, or half a second for short ones
+    IoWorker{sample_rate, channel_count, std::max(2 * size, sample_rate / 2)},
+    path_{path},
+    size_{size},
+    hop_{size / 2},
+    window_(size),
+    publish_frames_{std::max<size_t>(sample_rate / rate + .5, 1)},
+    pool_{std::max<size_t>(std::min(thread_count, channel_count), 1) - 1},
+    chunk_(CHUNK_FRAMES * channel_count)
+{
+    double sum = 0.;
+    for (size_t n = 0; n != size_; ++n) {
+        window_[n] = .5 - .5 * std::cos(TWO_PI * n / size_);
+        sum += window_[n];
+    }
+    // Amplitude of a bin-centered sine is sum / 2 after windowing
+    power_scale_ = 4. / (sum * sum);
+    for (size_t c = 0; c != channel_count_; ++c) {
+        channels_.emplace_back(new Channel{size_});
+    }
+    // Fail early on a bad path
+    const auto tmp = path_ + ".tmp";
+    if (!std::unique_ptr<FILE, decltype(&std::fclose)>{std::fopen(tmp.c_str(), "w"), std::fclose}) {
+        throw runtime_error{str(format("can't write spectrum file: %1%") % tmp)};
+    }
+    std::remove(tmp.c_str());
+    for (auto& thread: pool_.threads()) {
+        lower_priority(thread);
+    }
+    needed_ = duration_secs * sample_rate_ + .5;
+    ldebug("SpectrumAnalyzer: %zd point spectra of %zd channels into %s every %zd frames\n",
+        size_, channel_count_, path_.c_str(), publish_frames_);
+    thread_.reset(new std::thread(&SpectrumAnalyzer::pump, this));
+    lower_priority(*thread_);
+}
+
+SpectrumAnalyzer::~SpectrumAnalyzer() {
+    stop();
+}
+
+void SpectrumAnalyzer::push(const Sample* const* channels, size_t frame_count) {
+    auto ring = buffer();
+    const size_t n = std::min(frame_count, jack_ringbuffer_write_space(ring) / frame_size_);
+    // Multiplex whole frames into ringbuffer
+    for (size_t i = 0; i != n; ++i) {
+        for (size_t c = 0; c != channel_count_; ++c) {
+            jack_ringbuffer_write(ring, reinterpret_cast<const char*>(&channels[c][i]), sizeof(Sample));
+        }
+    }
+    if (n != frame_count) {
+        skipped_ += frame_count - n;
+    }
+}
+
+void SpectrumAnalyzer::analyze(Channel& channel) {
+    const float* history = channel.history.data();
+    const float* window = window_.data();
+    float* windowed = channel.windowed.data();
+    for (size_t n = 0; n != size_; ++n) {
+        windowed[n] = history[n] * window[n];
+    }
+    channel.fft.forward(windowed, channel.re.data(), channel.im.data());
+    const float* re = channel.re.data();
+    const float* im = channel.im.data();
+    float* power = channel.power.data();
+    const size_t bins = channel.fft.bins();
+    for (size_t k = 0; k != bins; ++k) {
+        power[k] += re[k] * re[k] + im[k] * im[k];
+    }
+}
+
+void SpectrumAnalyzer::work_cycle() {
+    auto ring = buffer();
+    size_t readable = jack_ringbuffer_read_space(ring) / frame_size_;
+    while (readable != 0) {
+        const size_t count = std::min({readable, CHUNK_FRAMES, size_ - filled_});
+        jack_ringbuffer_read(ring, reinterpret_cast<char*>(chunk_.data()), count * frame_size_);
+        for (size_t c = 0; c != channel_count_; ++c) {
+            float* history = channels_[c]->history.data() + filled_;
+            for (size_t i = 0; i != count; ++i) {
+                history[i] = chunk_[i * channel_count_ + c];
+            }
+        }
+        filled_ += count;
+        readable -= count;
+        done_ += count;
+        since_publish_ += count;
+        if (filled_ == size_) {
+            pool_.run(channel_count_, [this](size_t c) {
+                analyze(*channels_[c]);
+            });
+            ++segments_;
+            // Next segment overlaps this one by half
+            for (auto& channel: channels_) {
+                std::memmove(channel->history.data(), channel->history.data() + hop_, (size_ - hop_) * sizeof(float));
+            }
+            filled_ = size_ - hop_;
+        }
+        if (since_publish_ >= publish_frames_ && segments_ != 0) {
+            publish();
+        }
+    }
+}
+
+void SpectrumAnalyzer::flush() {
+    if (segments_ != 0) {
+        publish();
+    }
+    ldebug("SpectrumAnalyzer::flush(): %zd spectra published, %zd frames skipped\n", updates_, skipped_.load());
+}
+
+void SpectrumAnalyzer::publish() {
+    // Replace the file atomically, readers never see it half-written
+    const auto tmp = path_ + ".tmp";
+    std::unique_ptr<FILE, decltype(&std::fclose)> f{std::fopen(tmp.c_str(), "w"), std::fclose};
+    if (!f) {
+        throw runtime_error{str(format("can't write spectrum file: %1%") % tmp)};
+    }
+    const double scale = power_scale_ / segments_;
+    std::fprintf(f.get(), "{\n  \"sample_rate\": %zu,\n  \"fft_size\": %zu,\n  \"window\": \"hann\",\n  \"bin_hz\": %.6f,\n"
+        "  \"frame\": %zu,\n  \"time\": %.6f,\n  \"averages\": %zu,\n  \"frames_skipped\": %zu,\n  \"channels\": [",
+        sample_rate_, size_, sample_rate_ / (double)size_, done_, done_ / (double)sample_rate_, segments_, skipped_.load());
+    for (size_t c = 0; c != channel_count_; ++c) {
+        auto& power = channels_[c]->power;
+        std::fprintf(f.get(), "%s\n    [", c == 0 ? "" : ",");
+        for (size_t k = 0; k != power.size(); ++k) {
+            const double level = power[k] > 0 ? std::max(DB_FLOOR, 10. * std::log10(power[k] * scale)) : DB_FLOOR;
+            std::fprintf(f.get(), k == 0 ? "%.1f" : ", %.1f", level);
+        }
+        std::fputc(']', f.get());
+        std::fill(power.begin(), power.end(), 0.f);
+    }
+    std::fprintf(f.get(), "\n  ]\n}\n");
+    if (std::fclose(f.release()) != 0) {
+        throw runtime_error{str(format("failed writing spectrum file: %1%") % tmp)};
+    }
+#ifdef _WIN32
+    std::remove(path_.c_str());
+#endif
+    if (std::rename(tmp.c_str(), path_.c_str()) != 0) {
+        throw runtime_error{str(format("can't replace spectrum file: %1%") % path_)};
+    }
+    segments_ = 0;
+    since_publish_ = 0;
+    ++updates_;
+}
+
+}
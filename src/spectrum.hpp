@@ -0,0 +1,76 @@
+#pragma once
+#include "types.hpp"
+#include "io.hpp"
+#include "fft.hpp"
+#include "pool.hpp"
+
+#include <memory>
+#include <atomic>
+
+namespace olo {
+
+// Welch spectra of captured channels: Hann-windowed segments overlapping by
+// half are transformed and their power averaged over each publishing period,
+// then written into a JSON file replaced atomically. RT thread only copies
+// frames into the ringbuffer and drops them if it's full, all the analysis
+// runs on the worker and a pool of idle-priority threads.
+class SpectrumAnalyzer: public IoWorker {
+    struct Channel {
+        explicit Channel(size_t size);
+
+        RealFft fft;
+        // Last `size` frames of the channel
+        vector<float> history;
+        vector<float> windowed;
+        vector<float> re;
+        vector<float> im;
+        // Sum of power spectra since last publishing
+        vector<float> power;
+    };
+
+    string path_;
+    size_t size_;
+    size_t hop_;
+    vector<float> window_;
+    // Scales power so that a full-scale sine peaks at 0 dB
+    float power_scale_;
+    size_t publish_frames_;
+    vector<std::unique_ptr<Channel>> channels_;
+    ThreadPool pool_;
+    vector<Sample> chunk_;
+    // Frames of current segment in history
+    size_t filled_ = 0;
+    size_t segments_ = 0;
+    size_t since_publish_ = 0;
+    size_t updates_ = 0;
+    // Frames RT thread dropped because the ringbuffer was full
+    std::atomic<size_t> skipped_{0};
+
+    void work_cycle() override;
+    void flush() override;
+    void analyze(Channel& channel);
+    void publish();
+
+public:
+    // `size` is the FFT length, `rate` number of spectra published per second;
+    // `duration_secs` of 0 means until stopped.
+    explicit SpectrumAnalyzer(
+        const string& path,
+        size_t sample_rate,
+        size_t channel_count,
+        size_t size,
+        double rate,
+        size_t thread_count,
+        double duration_secs = 0.
+    );
+    ~SpectrumAnalyzer();
+
+    const string& path() const { return path_; }
+    size_t updates() const { return updates_; }
+    size_t frames_skipped() const { return skipped_; }
+
+    // Called from RT thread with per-channel buffers of `frame_count` samples.
+    void push(const Sample* const* channels, size_t frame_count);
+};
+
+}
@@ -0,0 +1,86 @@
+#include "trigger.hpp"
+
+#include <boost/format.hpp>
+
+#include <stdexcept>
+#include <cmath>
+
+namespace olo {
+using std::runtime_error;
+using boost::format;
+
+const size_t LevelTrigger::BLOCK_FRAMES;
+
+LevelTrigger::LevelTrigger(size_t channel_count, const vector<size_t>& channels, double level_dbfs):
+    channel_count_{channel_count},
+    channels_{channels},
+    threshold_{static_cast<Sample>(std::pow(10., level_dbfs / 20.))},
+    weights_(BLOCK_FRAMES * channel_count)
+{
+    if (channels_.empty()) {
+        for (size_t c = 0; c != channel_count_; ++c) {
+            channels_.push_back(c);
+        }
+    }
+    for (auto c: channels_) {
+        if (c >= channel_count_) {
+            throw runtime_error{str(format("trigger channel %1% out of %2% recorded channels")
+                % (c + 1) % channel_count_)};
+        }
+        for (size_t n = 0; n != BLOCK_FRAMES; ++n) {
+            weights_[n * channel_count_ + c] = 1;
+        }
+    }
+}
+
+size_t LevelTrigger::count_loud(const Sample* samples, size_t sample_count) const {
+    const Sample* weights = weights_.data();
+    size_t hits = 0;
+    // No branches nor early exit, so that this compiles into SIMD compares & adds
+    for (size_t i = 0; i != sample_count; ++i) {
+        hits += std::fabs(samples[i]) * weights[i] > threshold_;
+    }
+    return hits;
+}
+
+bool LevelTrigger::loud(const Sample* frame) const {
+    for (auto c: channels_) {
+        if (std::fabs(frame[c]) > threshold_) {
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t LevelTrigger::find_first(const Sample* frames, size_t frame_count) const {
+    for (size_t begin = 0; begin < frame_count; begin += BLOCK_FRAMES) {
+        const size_t end = std::min(begin + BLOCK_FRAMES, frame_count);
+        if (count_loud(frames + begin * channel_count_, (end - begin) * channel_count_) == 0) {
+            continue;
+        }
+        for (size_t n = begin; n != end; ++n) {
+            if (loud(frames + n * channel_count_)) {
+                return n;
+            }
+        }
+    }
+    return frame_count;
+}
+
+size_t LevelTrigger::find_last(const Sample* frames, size_t frame_count) const {
+    for (size_t end = frame_count; end != 0; ) {
+        // Blocks are aligned to the start of frames, the last one may be shorter
+        const size_t begin = (end - 1) / BLOCK_FRAMES * BLOCK_FRAMES;
+        if (count_loud(frames + begin * channel_count_, (end - begin) * channel_count_) != 0) {
+            for (size_t n = end; n != begin; --n) {
+                if (loud(frames + (n - 1) * channel_count_)) {
+                    return n - 1;
+                }
+            }
+        }
+        end = begin;
+    }
+    return frame_count;
+}
+
+}
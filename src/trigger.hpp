@@ -0,0 +1,44 @@
+#pragma once
+#include "types.hpp"
+
+namespace olo {
+
+// Level-triggered recording: only stretches of input around events louder than a threshold get recorded.
+struct TriggerSettings {
+    // Recording starts when any of the channels exceeds this peak level
+    double level_dbfs = -40.;
+    // Channels watched, counted from 0; empty means all of them
+    vector<size_t> channels;
+    // Length of input preceding the trigger included in recording
+    double pre_secs = 1.;
+    // Recording stops after the channels stay below level for this long
+    double hold_secs = 2.;
+};
+
+// Finds frames whose selected channels peak above a threshold. Frames are
+// scanned in blocks with a branchless loop the compiler vectorizes, the exact
+// frame is searched for only within blocks which contain one.
+class LevelTrigger {
+public:
+    static const size_t BLOCK_FRAMES = 64;
+
+private:
+    size_t channel_count_;
+    vector<size_t> channels_;
+    Sample threshold_;
+    // Weights for a block of interleaved samples: 1 for selected channels, 0 for others
+    vector<Sample> weights_;
+
+    size_t count_loud(const Sample* samples, size_t sample_count) const;
+    bool loud(const Sample* frame) const;
+
+public:
+    explicit LevelTrigger(size_t channel_count, const vector<size_t>& channels, double level_dbfs);
+
+    // Index of first loud frame of interleaved `frames`, `frame_count` if there's none.
+    size_t find_first(const Sample* frames, size_t frame_count) const;
+    // Index of last loud frame of interleaved `frames`, `frame_count` if there's none.
+    size_t find_last(const Sample* frames, size_t frame_count) const;
+};
+
+}
@@ -34,9 +34,16 @@ const string ABOUT = NAME_DISPLAY + " v" + VERSION + "\nPlay and record multi-ch
         "Copyright (C) 2020  Christopher Brown <cbrown1@pitt.edu>\n"
 		"Distributed under the terms of the GNU GPL, v3 or later\n";
 const string NULL_OUTPUT = "null";
+// File path standing for stdin/stdout, streamed as raw interleaved float32
+const string STDIO_PATH = "-";
 
 class Reader;
 class Writer;
+class ShmPublisher;
+class RamRecorder;
+class SoakTest;
+class SpectrumAnalyzer;
 class JackClient;
+class SessionManager;
 
 }
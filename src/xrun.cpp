@@ -0,0 +1,136 @@
+#include "xrun.hpp"
+#include "log.hpp"
+
+#include <boost/format.hpp>
+
+#include <stdexcept>
+#include <chrono>
+#include <cstdio>
+
+namespace olo {
+using std::runtime_error;
+using boost::format;
+
+namespace {
+// Events are rare, this covers a burst of them between two wakeups of the logging thread
+const size_t EVENTS_MAX = 1024;
+
+const char* cause_name(XrunCause cause) {
+    switch (cause) {
+    case XrunCause::CAPTURE_OVERRUN:
+        return "capture_overrun";
+    case XrunCause::PLAYBACK_UNDERRUN:
+        return "playback_underrun";
+    case XrunCause::JACK_XRUN:
+        return "jack_xrun";
+    }
+    return "unknown";
+}
+}
+
+XrunLog::XrunLog(const string& path, size_t sample_rate, bool preserve_timeline):
+    path_{path},
+    sample_rate_{sample_rate},
+    preserve_timeline_{preserve_timeline},
+    events_{jack_ringbuffer_create(EVENTS_MAX * sizeof(XrunEvent)), &jack_ringbuffer_free}
+{
+    if (!events_) {
+        throw runtime_error{"unable to allocate xrun event buffer"};
+    }
+    // Fail early on a bad path, and leave a valid empty log behind
+    save();
+    thread_.reset(new std::thread(&XrunLog::run, this));
+}
+
+XrunLog::~XrunLog() {
+    try {
+        close();
+    } catch (std::exception& ex) {
+        lerror("XrunLog::~XrunLog(): %s\n", ex.what());
+    }
+}
+
+void XrunLog::post(const XrunEvent& event) {
+    if (jack_ringbuffer_write_space(events_.get()) < sizeof(event)) {
+        ++lost_;
+        return;
+    }
+    jack_ringbuffer_write(events_.get(), reinterpret_cast<const char*>(&event), sizeof(event));
+    cv_.notify_one();
+}
+
+bool XrunLog::drain() {
+    bool changed = false;
+    XrunEvent event;
+    while (jack_ringbuffer_read(events_.get(), reinterpret_cast<char*>(&event), sizeof(event)) == sizeof(event)) {
+        if (!log_.empty() && log_.back().cause == event.cause
+                && log_.back().frame + log_.back().frame_count == event.frame) {
+            // Continuation of an xrun spanning several cycles
+            log_.back().frame_count += event.frame_count;
+        } else {
+            log_.push_back(event);
+        }
+        changed = true;
+    }
+    return changed;
+}
+
+void XrunLog::run() {
+    std::unique_lock<std::mutex> lock{mx_};
+    while (!break_) {
+        cv_.wait_for(lock, std::chrono::seconds(1));
+        lock.unlock();
+        try {
+            if (drain()) {
+                save();
+            }
+        } catch (std::exception& ex) {
+            lerror("XrunLog::run(): %s\n", ex.what());
+        }
+        lock.lock();
+    }
+}
+
+void XrunLog::close() {
+    if (!thread_) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock{mx_};
+        break_ = true;
+    }
+    cv_.notify_one();
+    thread_->join();
+    thread_.reset();
+    drain();
+    save();
+}
+
+void XrunLog::save() const {
+    // Replace the log atomically, readers never see it half-written
+    const auto tmp = path_ + ".tmp";
+    std::unique_ptr<FILE, decltype(&std::fclose)> f{std::fopen(tmp.c_str(), "w"), std::fclose};
+    if (!f) {
+        throw runtime_error{str(format("can't write xrun log: %1%") % tmp)};
+    }
+    std::fprintf(f.get(), "{\n  \"sample_rate\": %zu,\n  \"preserve_timeline\": %s,\n  \"events_lost\": %zu,\n  \"xruns\": [",
+        sample_rate_, preserve_timeline_ ? "true" : "false", lost_.load());
+    for (size_t i = 0; i != log_.size(); ++i) {
+        auto& event = log_[i];
+        std::fprintf(f.get(), "%s\n    {\"cause\": \"%s\", \"frame\": %zu, \"time\": %.6f, \"jack_frame\": %u, \"frames\": %zu, \"duration\": %.6f}",
+            i == 0 ? "" : ",", cause_name(event.cause), event.frame, event.frame / (double)sample_rate_,
+            event.jack_frame, event.frame_count, event.frame_count / (double)sample_rate_);
+    }
+    std::fprintf(f.get(), "%s]\n}\n", log_.empty() ? "" : "\n  ");
+    if (std::fclose(f.release()) != 0) {
+        throw runtime_error{str(format("failed writing xrun log: %1%") % tmp)};
+    }
+#ifdef _WIN32
+    std::remove(path_.c_str());
+#endif
+    if (std::rename(tmp.c_str(), path_.c_str()) != 0) {
+        throw runtime_error{str(format("can't replace xrun log: %1%") % path_)};
+    }
+}
+
+}
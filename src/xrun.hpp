@@ -0,0 +1,70 @@
+#pragma once
+#include "types.hpp"
+
+#include <jack/jack.h>
+#include <jack/ringbuffer.h>
+
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace olo {
+
+enum class XrunCause {
+    // Record ringbuffer full, Writer fell behind
+    CAPTURE_OVERRUN,
+    // Playback ringbuffer empty, Reader fell behind
+    PLAYBACK_UNDERRUN,
+    // Jack frame time skipped ahead, whole cycles were lost
+    JACK_XRUN
+};
+
+struct XrunEvent {
+    XrunCause cause;
+    // Position in session timeline, frames since start
+    size_t frame;
+    // Absolute Jack frame time of the first frame affected
+    jack_nframes_t jack_frame;
+    size_t frame_count;
+};
+
+// Collects xruns reported from RT thread and keeps a JSON sidecar file listing
+// them up to date, so that it's valid even if the process gets killed.
+class XrunLog {
+    string path_;
+    size_t sample_rate_;
+    bool preserve_timeline_;
+    std::unique_ptr<jack_ringbuffer_t, decltype(&jack_ringbuffer_free)> events_;
+    // Consecutive events of the same cause are merged
+    vector<XrunEvent> log_;
+    // Events which didn't fit into events_
+    std::atomic<size_t> lost_{0};
+    std::unique_ptr<std::thread> thread_;
+    std::mutex mx_;
+    std::condition_variable cv_;
+    bool break_ = false;
+
+    void run();
+    bool drain();
+    void save() const;
+
+public:
+    explicit XrunLog(const string& path, size_t sample_rate, bool preserve_timeline);
+    ~XrunLog();
+
+    XrunLog(const XrunLog&) = delete;
+    XrunLog& operator=(const XrunLog&) = delete;
+
+    const string& path() const { return path_; }
+    // Number of xruns logged, valid after close()
+    size_t count() const { return log_.size(); }
+
+    // Called from RT thread.
+    void post(const XrunEvent& event);
+    // Writes out remaining events and stops the logging thread.
+    void close();
+};
+
+}
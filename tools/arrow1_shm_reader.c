@@ -0,0 +1,106 @@
+/*
+ * Minimal reader of the shared memory stream published by `arrow1 --shm=NAME`.
+ * Attaches to the segment and prints peak level of every channel a few times
+ * per second until arrow1 finishes capturing.
+ *
+ * Usage: arrow1_shm_reader NAME [interval_ms]
+ */
+#include "arrow1_shm.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static uint64_t load_acquire(const volatile uint64_t* p) {
+    uint64_t v = *p;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return v;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s NAME [interval_ms]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    char name[256];
+    snprintf(name, sizeof(name), "%s%s", argv[1][0] == '/' ? "" : "/", argv[1]);
+    long interval_ms = argc > 2 ? atol(argv[2]) : 200;
+
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        fprintf(stderr, "can't open shared memory segment %s: %s\n", name, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct arrow1_shm_header)) {
+        fprintf(stderr, "shared memory segment %s is not ready\n", name);
+        return EXIT_FAILURE;
+    }
+    const char* base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "can't map shared memory segment %s: %s\n", name, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    const volatile struct arrow1_shm_header* hdr = (const void*)base;
+    if (load_acquire(&hdr->magic) != ARROW1_SHM_MAGIC || hdr->version != ARROW1_SHM_VERSION) {
+        fprintf(stderr, "%s is not an arrow1 stream of version %d\n", name, ARROW1_SHM_VERSION);
+        return EXIT_FAILURE;
+    }
+    const uint32_t channels = hdr->channels;
+    const uint64_t capacity = hdr->capacity;
+    const float* data = (const float*)(base + hdr->data_offset);
+    printf("%s: %u channels, %u Hz, %llu frames ring\n", name, channels, hdr->sample_rate,
+        (unsigned long long)capacity);
+
+    float* peaks = calloc(channels, sizeof(float));
+    uint64_t next = load_acquire(&hdr->write_index);
+    for (;;) {
+        int finished = hdr->state == ARROW1_SHM_FINISHED;
+        uint64_t w = load_acquire(&hdr->write_index);
+        uint64_t lost = 0;
+        if (w - next > capacity) {
+            lost = w - capacity - next;
+            next = w - capacity;
+        }
+        memset(peaks, 0, channels * sizeof(float));
+        for (uint64_t f = next; f != w; ++f) {
+            const float* frame = &data[(f & (capacity - 1)) * channels];
+            for (uint32_t c = 0; c != channels; ++c) {
+                float a = fabsf(frame[c]);
+                if (a > peaks[c]) {
+                    peaks[c] = a;
+                }
+            }
+        }
+        /* Anything older than one ring behind the current write index might have been overwritten */
+        uint64_t w2 = load_acquire(&hdr->write_index);
+        if (w2 - next > capacity) {
+            lost += w2 - capacity - next;
+        }
+        printf("%12llu", (unsigned long long)w);
+        for (uint32_t c = 0; c != channels; ++c) {
+            printf(" %6.1f", peaks[c] > 0 ? 20 * log10f(peaks[c]) : -INFINITY);
+        }
+        if (lost != 0) {
+            printf("  (%llu frames lost)", (unsigned long long)lost);
+        }
+        printf("\n");
+        fflush(stdout);
+        next = w;
+        if (finished) {
+            break;
+        }
+        usleep(interval_ms * 1000);
+    }
+    free(peaks);
+    munmap((void*)base, st.st_size);
+    return EXIT_SUCCESS;
+}